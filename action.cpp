@@ -0,0 +1,237 @@
+//////////////////////////////////////////////////////////////////////
+// action.cpp -- Dedupe or hard link confirmed duplicate sets
+// Date: Sun Oct 18 14:51:37 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+
+#include "action.hpp"
+
+bool
+DupAction::parse(const char *name,Action& action) {
+
+	if ( !strcmp(name,"dedupe") )
+		action = Action::Dedupe;
+	else if ( !strcmp(name,"hardlink") )
+		action = Action::Hardlink;
+	else if ( !strcmp(name,"none") )
+		action = Action::None;
+	else	return false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Share the extents of src with each of dests, size bytes long. The
+// ranges are issued max_range at a time, with up to max_dests
+// destinations per call. A dest that differs or fails drops out of
+// later calls. A src that cannot be opened is reported here, and
+// fails every dest.
+//
+// Returns 0, or errno when the filesystem cannot dedupe src at all
+// (no status is then meaningful).
+//////////////////////////////////////////////////////////////////////
+
+int
+DupAction::dedupe(const std::string& src,const std::vector<std::string>& dests,uint64_t size,std::vector<int>& status) {
+
+	status.assign(dests.size(),Same);
+	if ( size == 0 )
+		return 0;		// Nothing to share
+
+#ifdef FIDEDUPERANGE
+	std::vector<int> fds(dests.size(),-1);
+	std::vector<uint64_t> deduped(dests.size(),0);
+	std::vector<char> mem(sizeof(file_dedupe_range) + max_dests * sizeof(file_dedupe_range_info));
+	file_dedupe_range *range = (file_dedupe_range *)mem.data();
+	std::vector<unsigned> live;
+	int sfd, rc = 0;
+
+	if ( (sfd = ::open(src.c_str(),O_RDONLY)) == -1 ) {
+		const int err = errno;
+
+		fprintf(stderr,"%s: opening %s for dedupe\n",strerror(err),src.c_str());
+		status.assign(dests.size(),-err);
+		nfailed += dests.size();
+		return 0;
+	}
+
+	// Read access suffices for the owner of the destination
+	for ( size_t dx=0; dx < dests.size(); ++dx )
+		if ( (fds[dx] = ::open(dests[dx].c_str(),O_RDONLY)) == -1 )
+			status[dx] = -errno;
+
+	for ( uint64_t offset=0; offset < size && rc == 0; offset += max_range ) {
+		const uint64_t len = std::min(max_range,size - offset);
+
+		live.clear();
+		for ( unsigned dx=0; dx < dests.size(); ++dx )
+			if ( status[dx] == Same )
+				live.push_back(dx);
+
+		for ( size_t lx=0; lx < live.size(); lx += max_dests ) {
+			const unsigned n = std::min(size_t(max_dests),live.size() - lx);
+
+			memset(mem.data(),0,mem.size());
+			range->src_offset = offset;
+			range->src_length = len;
+			range->dest_count = n;
+			for ( unsigned ix=0; ix < n; ++ix ) {
+				range->info[ix].dest_fd = fds[live[lx+ix]];
+				range->info[ix].dest_offset = offset;
+			}
+
+			auto t0 = std::chrono::steady_clock::now();
+
+			if ( ::ioctl(sfd,FIDEDUPERANGE,range) == -1 ) {
+				rc = errno;
+				break;
+			}
+			ioctl_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - t0).count();
+			++nioctls;
+			ioctl_bytes += len * n;
+
+			for ( unsigned ix=0; ix < n; ++ix ) {
+				const file_dedupe_range_info& info = range->info[ix];
+				const unsigned dx = live[lx+ix];
+
+				if ( info.status < 0 )
+					status[dx] = info.status;
+				else if ( info.status == FILE_DEDUPE_RANGE_DIFFERS )
+					status[dx] = Differs;
+				else if ( info.bytes_deduped != len )
+					status[dx] = -EAGAIN;	// Only partly shared
+				deduped[dx] += info.bytes_deduped;
+			}
+		}
+	}
+
+	::close(sfd);
+	for ( auto fd : fds )
+		if ( fd >= 0 )
+			::close(fd);
+
+	if ( rc )
+		return rc;
+
+	// A dest not shared to the end gave up nothing whole
+	for ( size_t dx=0; dx < dests.size(); ++dx ) {
+		if ( status[dx] == Same ) {
+			++nfiles;
+			reclaimed += deduped[dx];
+		} else	{
+			partial += deduped[dx];
+			if ( status[dx] < 0 )
+				++nfailed;
+		}
+	}
+	return 0;
+#else
+	return ENOTSUP;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+// Replace every name of each copy with a hard link to the first
+// file of the set. The link is made under a temporary name and
+// renamed over the old one, so a name never goes missing.
+//////////////////////////////////////////////////////////////////////
+
+void
+DupAction::hardlink(const s_dupset& set) {
+	const std::string& keep = set.files[0].path;
+	const std::string suffix = ".deduper." + std::to_string(getpid());
+
+	auto replace = [&](const std::string& path) -> bool {
+		std::string tmp(path + suffix);
+
+		if ( ::link(keep.c_str(),tmp.c_str()) == -1 ) {
+			fprintf(stderr,"%s: linking %s to %s\n",strerror(errno),path.c_str(),keep.c_str());
+			return false;
+		}
+		if ( ::rename(tmp.c_str(),path.c_str()) == -1 ) {
+			fprintf(stderr,"%s: replacing %s\n",strerror(errno),path.c_str());
+			::unlink(tmp.c_str());
+			return false;
+		}
+		return true;
+	};
+
+	for ( size_t fx=1; fx < set.files.size(); ++fx ) {
+		const s_dupfile& file = set.files[fx];
+		bool all = replace(file.path);
+
+		for ( auto& link : file.links )
+			all = replace(link) && all;
+
+		if ( all ) {
+			++nfiles;
+			reclaimed += set.size;	// Unless linked from outside the tree
+		} else	++nfailed;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Act on a verified duplicate set
+//////////////////////////////////////////////////////////////////////
+
+void
+DupAction::apply(const s_dupset& set) {
+
+	if ( action == Action::None || set.files.size() < 2 )
+		return;
+
+	if ( action == Action::Hardlink ) {
+		hardlink(set);
+	} else	{
+		std::vector<std::string> dests;
+		std::vector<int> status;
+
+		for ( size_t fx=1; fx < set.files.size(); ++fx )
+			dests.push_back(set.files[fx].path);
+
+		int rc = dedupe(set.files[0].path,dests,set.size,status);
+
+		if ( rc ) {
+			if ( !warned.exchange(true) )
+				fprintf(stderr,"%s: FIDEDUPERANGE on %s (further failures not shown)\n",
+					strerror(rc),set.files[0].path.c_str());
+			nfailed += dests.size();
+		}
+	}
+	++nsets;
+}
+
+void
+DupAction::report(FILE *out) {
+	const double secs = ioctl_ns.load() / 1e9;
+	const double mb = ioctl_bytes.load() / 1048576.0;
+
+	fprintf(out,"%s: %llu files in %llu sets, %llu failed, %llu bytes reclaimed\n",
+		action == Action::Hardlink ? "Hardlink" : "Dedupe",
+		(unsigned long long)nfiles.load(),
+		(unsigned long long)nsets.load(),
+		(unsigned long long)nfailed.load(),
+		(unsigned long long)reclaimed.load());
+	if ( partial.load() > 0 )
+		fprintf(out,"Dedupe: %llu more bytes shared by copies not shared in full\n",
+			(unsigned long long)partial.load());
+	if ( nioctls.load() > 0 )
+		fprintf(out,"FIDEDUPERANGE: %llu calls, %.1f MB compared in %.3f s, %.1f MB/s\n",
+			(unsigned long long)nioctls.load(),
+			mb,secs,secs > 0 ? mb / secs : 0.0);
+}
+
+// End action.cpp
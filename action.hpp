@@ -0,0 +1,63 @@
+//////////////////////////////////////////////////////////////////////
+// action.hpp -- Dedupe or hard link confirmed duplicate sets
+// Date: Sun Oct 18 14:32:09 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef ACTION_HPP
+#define ACTION_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "output.hpp"
+
+enum class Action {
+	None,
+	Dedupe,		// Share extents with FIDEDUPERANGE
+	Hardlink	// Replace copies with hard links to the first
+};
+
+//////////////////////////////////////////////////////////////////////
+// With Dedupe, the kernel compares the data itself and only shares
+// ranges that are identical, so dedupe() can also serve to verify
+// candidates. Each dest ends with a status of Same, Differs, or a
+// negative errno.
+//////////////////////////////////////////////////////////////////////
+
+class DupAction {
+	static const uint64_t max_range = 16 * 1024 * 1024;	// btrfs limit per call
+	static const unsigned max_dests = 120;			// Per call (one page)
+
+	Action			action = Action::None;
+	std::atomic<bool>	warned;		// Reported a failing dedupe
+
+	void hardlink(const s_dupset& set);
+
+public:	enum { Same = 0, Differs = 1 };
+
+	std::atomic<uint64_t>	nsets;		// Sets acted on
+	std::atomic<uint64_t>	nfiles;		// Copies shared or linked
+	std::atomic<uint64_t>	nfailed;	// Copies that could not be
+	std::atomic<uint64_t>	reclaimed;	// Bytes, of copies shared in full
+	std::atomic<uint64_t>	partial;	// Bytes shared of the other copies
+	std::atomic<uint64_t>	nioctls;
+	std::atomic<uint64_t>	ioctl_bytes;	// Bytes compared by the kernel
+	std::atomic<uint64_t>	ioctl_ns;	// Time in FIDEDUPERANGE
+
+	DupAction() : warned(false), nsets(0), nfiles(0), nfailed(0), reclaimed(0), partial(0),
+		nioctls(0), ioctl_bytes(0), ioctl_ns(0) {}
+	static bool parse(const char *name,Action& action);
+	void set(Action action) { this->action = action; }
+	Action get() const { return action; }
+	int dedupe(const std::string& src,const std::vector<std::string>& dests,uint64_t size,std::vector<int>& status);
+	void apply(const s_dupset& set);
+	void report(FILE *out);
+};
+
+#endif // ACTION_HPP
+
+// End action.hpp
@@ -0,0 +1,263 @@
+//////////////////////////////////////////////////////////////////////
+// bench_run.cpp -- End-to-end benchmark runner
+// Date: Sun Oct 18 21:37:40 2026   (C) datablocks.net
+//
+// Runs deduper -v over a tree for each combination of thread count
+// and I/O engine, and writes one JSON line per run: wall time, the
+// time of each phase (from deduper's "Phase" traces), files and bytes
+// per second, peak RSS and the number of duplicate sets. File and
+// byte counts come from the tree's TREEGEN.json (see treegen.cpp).
+//
+// With --cold, the page cache is dropped before each run (this needs
+// root, and is noted as "cold":false in the results otherwise).
+//
+//	./bench_run [options] tree
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include <string>
+#include <vector>
+#include <map>
+
+static std::string opt_deduper = "./deduper";
+static std::string opt_threads = "1,4";
+static std::string opt_io = "pread,mmap,uring";
+static std::string opt_extra;
+static std::string opt_out;
+static unsigned opt_repeat = 1;
+static bool opt_cold = false;
+
+struct s_result {
+	int				status = -1;
+	double				wall = 0;
+	long				maxrss = 0;	// KiB
+	long				sets = -1;
+	std::vector<std::pair<std::string,double>> phases;
+};
+
+static std::vector<std::string>
+split(const std::string& s,char sep) {
+	std::vector<std::string> v;
+	size_t from = 0;
+
+	while ( from <= s.size() ) {
+		size_t to = s.find(sep,from);
+
+		if ( to == std::string::npos )
+			to = s.size();
+		if ( to > from )
+			v.push_back(s.substr(from,to - from));
+		from = to + 1;
+	}
+	return v;
+}
+
+//////////////////////////////////////////////////////////////////////
+// A number from the manifest, by key (0 when absent)
+//////////////////////////////////////////////////////////////////////
+
+static unsigned long long
+manifest(const std::string& text,const char *key) {
+	const std::string quoted = std::string("\"") + key + "\":";
+	size_t pos = text.find(quoted);
+
+	return pos == std::string::npos ? 0 : strtoull(text.c_str() + pos + quoted.size(),nullptr,10);
+}
+
+static bool
+drop_caches() {
+	int fd;
+
+	sync();
+	if ( (fd = ::open("/proc/sys/vm/drop_caches",O_WRONLY)) == -1 )
+		return false;
+
+	bool ok = ::write(fd,"3\n",2) == 2;
+
+	::close(fd);
+	return ok;
+}
+
+static double
+now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run deduper with args, taking in its output
+//////////////////////////////////////////////////////////////////////
+
+static s_result
+run(const std::vector<std::string>& args) {
+	std::vector<char *> argv;
+	s_result result;
+	struct rusage ru;
+	int fds[2], status;
+
+	for ( auto& arg : args )
+		argv.push_back((char *)arg.c_str());
+	argv.push_back(nullptr);
+
+	if ( pipe(fds) == -1 ) {
+		perror("pipe");
+		exit(1);
+	}
+
+	const double t0 = now();
+	pid_t pid = fork();
+
+	if ( pid == -1 ) {
+		perror("fork");
+		exit(1);
+	}
+	if ( pid == 0 ) {
+		::dup2(fds[1],1);
+		::close(fds[0]);
+		::close(fds[1]);
+		execv(argv[0],argv.data());
+		fprintf(stderr,"%s: exec %s\n",strerror(errno),argv[0]);
+		_exit(127);
+	}
+	::close(fds[1]);
+
+	FILE *in = fdopen(fds[0],"r");
+	char line[4096], name[64];
+	double secs;
+	long sets;
+
+	while ( fgets(line,sizeof line,in) ) {
+		if ( sscanf(line,"Phase %63[^:]: %lf s",name,&secs) == 2 )
+			result.phases.emplace_back(name,secs);
+		else if ( sscanf(line,"%ld duplicate sets",&sets) == 1 )
+			result.sets = sets;
+	}
+	fclose(in);
+
+	while ( wait4(pid,&status,0,&ru) == -1 )
+		if ( errno != EINTR ) {
+			perror("wait4");
+			exit(1);
+		}
+	result.wall = now() - t0;
+	result.status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+	result.maxrss = ru.ru_maxrss;
+	return result;
+}
+
+static void
+usage(const char *argv0) {
+
+	printf("Usage: %s [options] tree\n\n"
+		"\t--deduper path\tProgram to run (./deduper)\n"
+		"\t--threads list\tThread counts (1,4)\n"
+		"\t--io list\tI/O engines (pread,mmap,uring)\n"
+		"\t--repeat n\tRuns of each configuration (1)\n"
+		"\t--cold\t\tDrop the page cache before each run\n"
+		"\t--extra args\tFurther deduper options, space separated\n"
+		"\t--out file\tAppend results here (stdout)\n",
+		argv0);
+	exit(0);
+}
+
+int
+main(int argc,char **argv) {
+	static struct option long_options[] = {
+		{"deduper",	required_argument,	nullptr,	1 },	// 1
+		{"threads",	required_argument,	nullptr,	2 },	// 2
+		{"io",		required_argument,	nullptr,	3 },	// 3
+		{"repeat",	required_argument,	nullptr,	4 },	// 4
+		{"cold",	no_argument,		nullptr,	5 },	// 5
+		{"extra",	required_argument,	nullptr,	6 },	// 6
+		{"out",		required_argument,	nullptr,	7 },	// 7
+		{"help",	no_argument,		nullptr,	'h' },
+		{0,		0,			nullptr,	0 },	// End
+	};
+	int ch;
+
+	while ( (ch = getopt_long(argc,argv,"h",long_options,nullptr)) != -1 ) {
+		switch ( ch ) {
+		case 1:	opt_deduper = optarg; break;
+		case 2:	opt_threads = optarg; break;
+		case 3:	opt_io = optarg; break;
+		case 4:	opt_repeat = strtoul(optarg,nullptr,10); break;
+		case 5:	opt_cold = true; break;
+		case 6:	opt_extra = optarg; break;
+		case 7:	opt_out = optarg; break;
+		case 'h':
+			usage(argv[0]);
+		default:
+			exit(1);
+		}
+	}
+
+	if ( optind + 1 != argc )
+		usage(argv[0]);
+
+	const std::string tree(argv[optind]);
+	std::string text;
+	FILE *out = stdout;
+
+	if ( FILE *f = fopen((tree + "/TREEGEN.json").c_str(),"r") ) {
+		char buf[1024];
+
+		while ( fgets(buf,sizeof buf,f) )
+			text += buf;
+		fclose(f);
+	} else	fprintf(stderr,"%s: no %s/TREEGEN.json, files/s and bytes/s will be 0\n",
+			strerror(errno),tree.c_str());
+
+	const unsigned long long nfiles = manifest(text,"files");
+	const unsigned long long nbytes = manifest(text,"bytes");
+
+	if ( !opt_out.empty() && !(out = fopen(opt_out.c_str(),"a")) ) {
+		fprintf(stderr,"%s: opening %s\n",strerror(errno),opt_out.c_str());
+		exit(1);
+	}
+
+	for ( auto& threads : split(opt_threads,',') )
+		for ( auto& io : split(opt_io,',') )
+			for ( unsigned rx=0; rx < opt_repeat; ++rx ) {
+				std::vector<std::string> args{opt_deduper,"-v","--threads",threads,"--io",io};
+				const bool cold = opt_cold && drop_caches();
+
+				for ( auto& arg : split(opt_extra,' ') )
+					args.push_back(arg);
+				args.push_back(tree);
+
+				s_result r = run(args);
+
+				fprintf(out,"{\"tree\":\"%s\",\"files\":%llu,\"bytes\":%llu,"
+					"\"threads\":%s,\"io\":\"%s\",\"run\":%u,\"cold\":%s,"
+					"\"exit\":%d,\"wall_s\":%.3f,\"phases\":{",
+					tree.c_str(),nfiles,nbytes,threads.c_str(),io.c_str(),rx,
+					cold ? "true" : "false",r.status,r.wall);
+				for ( size_t px=0; px < r.phases.size(); ++px )
+					fprintf(out,"%s\"%s\":%.3f",px ? "," : "",
+						r.phases[px].first.c_str(),r.phases[px].second);
+				fprintf(out,"},\"files_per_s\":%.0f,\"bytes_per_s\":%.0f,"
+					"\"max_rss_kb\":%ld,\"sets\":%ld}\n",
+					r.wall > 0 ? nfiles / r.wall : 0.0,
+					r.wall > 0 ? nbytes / r.wall : 0.0,
+					r.maxrss,r.sets);
+				fflush(out);
+			}
+
+	if ( out != stdout )
+		fclose(out);
+	return 0;
+}
+
+// End bench_run.cpp
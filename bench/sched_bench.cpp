@@ -0,0 +1,164 @@
+//////////////////////////////////////////////////////////////////////
+// sched_bench.cpp -- Directory scheduler scaling benchmark
+// Date: Sat Oct 17 17:03:55 2026   (C) datablocks.net
+//
+// Walks a synthetic in-memory tree with 1..64 threads, once with the
+// former scheme (one locked queue, an atomic depth count and a
+// usleep(1000) poll) and once with WorkStealer. Visiting a node
+// costs a fixed amount of hashing, standing in for getdents/stat.
+//
+//	./sched_bench [max_threads [work]]
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <queue>
+
+#include "sched.hpp"
+
+struct s_node {
+	uint32_t	depth;
+	uint64_t	id;
+};
+
+struct s_shape {
+	const char	*name;
+	uint32_t	max_depth;
+	unsigned	fanout;		// Children per directory
+};
+
+static const s_shape shapes[] = {
+	{ "deep-narrow",	18,	2 },
+	{ "wide-shallow",	3,	80 },
+	{ nullptr,		0,	0 }
+};
+
+static unsigned opt_work = 2000;
+static std::atomic<uint64_t> sink(0);
+
+static double
+now() {
+	timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC,&ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Visit a node, returning its children
+static void
+visit(const s_shape& shape,const s_node& node,std::vector<s_node>& children) {
+	uint64_t h = node.id;
+
+	for ( unsigned w=0; w < opt_work; ++w )
+		h = (h ^ (h >> 29)) * 0xbf58476d1ce4e5b9ULL;
+	sink += h & 1;
+
+	children.clear();
+	if ( node.depth >= shape.max_depth )
+		return;
+	for ( unsigned cx=0; cx < shape.fanout; ++cx )
+		children.push_back({ node.depth + 1, node.id * shape.fanout + cx + 1 });
+}
+
+//////////////////////////////////////////////////////////////////////
+// The scheme dive() used before WorkStealer
+//////////////////////////////////////////////////////////////////////
+
+static double
+run_poll(const s_shape& shape,unsigned nthreads) {
+	std::mutex mutex;
+	std::queue<s_node> queue;
+	std::atomic<long> depth(1);
+	std::vector<std::thread> tvec;
+	double t0 = now();
+
+	queue.push({ 0, 0 });
+
+	for ( unsigned thx=0; thx < nthreads; ++thx )
+		tvec.emplace_back([&]() {
+			std::vector<s_node> children;
+			s_node node;
+
+			for (;;) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+
+					if ( queue.empty() ) {
+						if ( !depth.load() )
+							break;
+						goto sleep;
+					}
+					node = queue.front();
+					queue.pop();
+				}
+				visit(shape,node,children);
+				for ( auto& child : children ) {
+					std::lock_guard<std::mutex> lock(mutex);
+
+					++depth;
+					queue.push(child);
+				}
+				--depth;
+				continue;
+sleep:				usleep(1000);
+			}
+		});
+	for ( auto& thread : tvec )
+		thread.join();
+	return now() - t0;
+}
+
+static double
+run_steal(const s_shape& shape,unsigned nthreads) {
+	WorkStealer<s_node> sched(nthreads);
+	std::vector<std::thread> tvec;
+	double t0 = now();
+
+	sched.push(0,{ 0, 0 });
+
+	for ( unsigned thx=0; thx < nthreads; ++thx )
+		tvec.emplace_back([&](unsigned thx) {
+			std::vector<s_node> children;
+			s_node node;
+
+			while ( sched.pop(thx,node) ) {
+				visit(shape,node,children);
+				for ( auto& child : children )
+					sched.push(thx,child);
+				sched.done();
+			}
+		},thx);
+	for ( auto& thread : tvec )
+		thread.join();
+	return now() - t0;
+}
+
+int
+main(int argc,char **argv) {
+	unsigned max_threads = argc > 1 ? atoi(argv[1]) : 64;
+
+	if ( argc > 2 )
+		opt_work = atoi(argv[2]);
+
+	printf("%-14s %7s %10s %10s %8s\n","shape","threads","poll s","steal s","speedup");
+	for ( const s_shape *sp = shapes; sp->name; ++sp ) {
+		for ( unsigned n=1; n <= max_threads; n *= 2 ) {
+			double tpoll = run_poll(*sp,n);
+			double tsteal = run_steal(*sp,n);
+
+			printf("%-14s %7u %10.3f %10.3f %7.2fx\n",
+				sp->name,n,tpoll,tsteal,tpoll / tsteal);
+			fflush(stdout);
+		}
+	}
+	return 0;
+}
+
+// End sched_bench.cpp
@@ -0,0 +1,304 @@
+//////////////////////////////////////////////////////////////////////
+// treegen.cpp -- Reproducible duplicate tree generator
+// Date: Sun Oct 18 21:04:12 2026   (C) datablocks.net
+//
+// Builds a tree of files for benchmarking deduper. The same options
+// and seed give the same tree, byte for byte. Of the files:
+//
+//	--dup-ratio	are copies of an earlier file
+//	--prefix-ratio	match an earlier file in size and first 1k,
+//			but differ further on (they must be hashed)
+//	--link-ratio	are hard links to an earlier file
+//
+// and the rest have content of their own. Sizes are drawn from
+// --sizes, one of fixed:n, uniform:min:max or log:min:max (log
+// uniform, the default). Files are spread over directories of
+// --fanout subdirectories each, about --per-dir files per directory.
+// TREEGEN.json in the top directory records what was made.
+//
+//	./treegen [options] directory
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <getopt.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+
+static uint64_t opt_seed = 1;
+static unsigned opt_files = 10000;
+static unsigned opt_fanout = 16;
+static unsigned opt_per_dir = 32;
+static double opt_dup = 0.20;
+static double opt_prefix = 0.05;
+static double opt_link = 0.02;
+static std::string opt_sizes = "log:1024:262144";
+
+//////////////////////////////////////////////////////////////////////
+// splitmix64: small, fast and the same everywhere
+//////////////////////////////////////////////////////////////////////
+
+static uint64_t
+mix64(uint64_t x) {
+
+	x += 0x9E3779B97F4A7C15ull;
+	x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+	x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+	return x ^ (x >> 31);
+}
+
+class Rng {
+	uint64_t	state;
+
+public:	Rng(uint64_t seed) : state(seed) {}
+	uint64_t next() { return mix64(state++); }
+	double real() { return (next() >> 11) * (1.0 / 9007199254740992.0); }
+	uint64_t below(uint64_t n) { return n ? next() % n : 0; }
+};
+
+struct s_sizes {
+	char		kind = 'l';	// f, u or l
+	uint64_t	min = 1024;
+	uint64_t	max = 262144;
+
+	bool parse(const std::string& spec) {
+		unsigned long long a = 0, b = 0;
+
+		if ( sscanf(spec.c_str(),"fixed:%llu",&a) == 1 ) {
+			kind = 'f';
+			min = max = a;
+		} else if ( sscanf(spec.c_str(),"uniform:%llu:%llu",&a,&b) == 2 && a <= b ) {
+			kind = 'u';
+			min = a;
+			max = b;
+		} else if ( sscanf(spec.c_str(),"log:%llu:%llu",&a,&b) == 2 && 0 < a && a <= b ) {
+			kind = 'l';
+			min = a;
+			max = b;
+		} else	return false;
+		return true;
+	}
+	uint64_t draw(Rng& rng) const {
+		switch ( kind ) {
+		case 'f':
+			return min;
+		case 'u':
+			return min + rng.below(max - min + 1);
+		default:
+			return uint64_t(exp(log(double(min)) + rng.real() * (log(double(max)) - log(double(min)))));
+		}
+	}
+};
+
+struct s_file {
+	std::string	path;
+	uint64_t	size;
+	uint64_t	content;	// Seed of the byte stream
+	int64_t		flip;		// Offset of a changed byte, else -1
+};
+
+//////////////////////////////////////////////////////////////////////
+// Write size bytes of the stream for content, with one byte changed
+// at flip (if not -1)
+//////////////////////////////////////////////////////////////////////
+
+static int
+write_file(const s_file& file) {
+	static const size_t blksiz = 64 * 1024;
+	std::vector<uint64_t> buf(blksiz / 8);
+	int fd = ::open(file.path.c_str(),O_WRONLY|O_CREAT|O_EXCL,0644);
+
+	if ( fd == -1 )
+		return errno;
+
+	for ( uint64_t offset=0; offset < file.size; offset += blksiz ) {
+		const size_t n = std::min(uint64_t(blksiz),file.size - offset);
+
+		for ( size_t wx=0; wx < (n + 7) / 8; ++wx )
+			buf[wx] = mix64(file.content ^ mix64(offset / 8 + wx));
+		if ( file.flip >= int64_t(offset) && file.flip < int64_t(offset + n) )
+			((uint8_t *)buf.data())[file.flip - offset] ^= 0x5A;
+
+		if ( ::write(fd,buf.data(),n) != ssize_t(n) ) {
+			int rc = errno ? errno : EIO;
+
+			::close(fd);
+			return rc;
+		}
+	}
+	return ::close(fd) == 0 ? 0 : errno;
+}
+
+static void
+usage(const char *argv0) {
+
+	printf("Usage: %s [options] directory\n\n"
+		"\t--seed n\tRandom seed (1)\n"
+		"\t--files n\tFiles to make, links included (10000)\n"
+		"\t--sizes spec\tfixed:n, uniform:min:max or log:min:max (log:1024:262144)\n"
+		"\t--dup-ratio r\tCopies of earlier files (0.20)\n"
+		"\t--prefix-ratio r\tSame size and first 1k, different later (0.05)\n"
+		"\t--link-ratio r\tHard links to earlier files (0.02)\n"
+		"\t--fanout n\tSubdirectories per directory (16)\n"
+		"\t--per-dir n\tFiles per directory, about (32)\n",
+		argv0);
+	exit(0);
+}
+
+int
+main(int argc,char **argv) {
+	static struct option long_options[] = {
+		{"seed",		required_argument,	nullptr,	1 },	// 1
+		{"files",		required_argument,	nullptr,	2 },	// 2
+		{"sizes",		required_argument,	nullptr,	3 },	// 3
+		{"dup-ratio",		required_argument,	nullptr,	4 },	// 4
+		{"prefix-ratio",	required_argument,	nullptr,	5 },	// 5
+		{"link-ratio",		required_argument,	nullptr,	6 },	// 6
+		{"fanout",		required_argument,	nullptr,	7 },	// 7
+		{"per-dir",		required_argument,	nullptr,	8 },	// 8
+		{"help",		no_argument,		nullptr,	'h' },
+		{0,			0,			nullptr,	0 },	// End
+	};
+	s_sizes sizes;
+	int ch;
+
+	while ( (ch = getopt_long(argc,argv,"h",long_options,nullptr)) != -1 ) {
+		switch ( ch ) {
+		case 1:	opt_seed = strtoull(optarg,nullptr,10); break;
+		case 2:	opt_files = strtoul(optarg,nullptr,10); break;
+		case 3:	opt_sizes = optarg; break;
+		case 4:	opt_dup = atof(optarg); break;
+		case 5:	opt_prefix = atof(optarg); break;
+		case 6:	opt_link = atof(optarg); break;
+		case 7:	opt_fanout = strtoul(optarg,nullptr,10); break;
+		case 8:	opt_per_dir = strtoul(optarg,nullptr,10); break;
+		case 'h':
+			usage(argv[0]);
+		default:
+			exit(1);
+		}
+	}
+
+	if ( optind + 1 != argc )
+		usage(argv[0]);
+	if ( !sizes.parse(opt_sizes) ) {
+		fprintf(stderr,"Bad --sizes %s\n",opt_sizes.c_str());
+		exit(1);
+	}
+	if ( opt_dup + opt_prefix + opt_link > 1.0 || opt_fanout < 1 || opt_per_dir < 1 ) {
+		fprintf(stderr,"Ratios must add up to at most 1, fanout and per-dir be >= 1\n");
+		exit(1);
+	}
+
+	const std::string top(argv[optind]);
+
+	if ( ::mkdir(top.c_str(),0755) == -1 ) {
+		fprintf(stderr,"%s: mkdir %s (it must not exist)\n",strerror(errno),top.c_str());
+		exit(1);
+	}
+
+	// Directories, breadth first, until there is room for the files
+	Rng rng(opt_seed);
+	std::vector<std::string> dirs(1,top);
+	const size_t ndirs = (opt_files + opt_per_dir - 1) / opt_per_dir;
+
+	for ( size_t px=0; dirs.size() < ndirs; ++px )
+		for ( unsigned cx=0; cx < opt_fanout && dirs.size() < ndirs; ++cx ) {
+			char name[32];
+
+			snprintf(name,sizeof name,"/d%03u",cx);
+			dirs.push_back(dirs[px] + name);
+			if ( ::mkdir(dirs.back().c_str(),0755) == -1 ) {
+				fprintf(stderr,"%s: mkdir %s\n",strerror(errno),dirs.back().c_str());
+				exit(1);
+			}
+		}
+
+	std::vector<s_file> files;
+	std::vector<size_t> originals;		// Files with content of their own
+	uint64_t bytes = 0, ndups = 0, nprefix = 0, nlinks = 0;
+
+	files.reserve(opt_files);
+	for ( unsigned fx=0; fx < opt_files; ++fx ) {
+		char name[32];
+		s_file file;
+		const double r = rng.real();
+
+		snprintf(name,sizeof name,"/f%06u.dat",fx);
+		file.path = dirs[rng.below(dirs.size())] + name;
+		file.flip = -1;
+
+		if ( !originals.empty() && r < opt_link ) {
+			const s_file& src = files[rng.below(files.size())];
+
+			if ( ::link(src.path.c_str(),file.path.c_str()) == -1 ) {
+				fprintf(stderr,"%s: link %s\n",strerror(errno),file.path.c_str());
+				exit(1);
+			}
+			file.size = src.size;
+			file.content = src.content;
+			file.flip = src.flip;
+			files.push_back(file);
+			bytes += file.size;
+			++nlinks;
+			continue;
+		}
+
+		if ( !originals.empty() && r < opt_link + opt_dup ) {
+			const s_file& src = files[originals[rng.below(originals.size())]];
+
+			file.size = src.size;
+			file.content = src.content;
+			++ndups;
+		} else if ( !originals.empty() && r < opt_link + opt_dup + opt_prefix
+		  && files[originals.back()].size > 1024 ) {
+			const s_file& src = files[originals.back()];
+
+			file.size = src.size;
+			file.content = src.content;
+			file.flip = 1024 + rng.below(src.size - 1024);
+			++nprefix;
+		} else	{
+			file.size = sizes.draw(rng);
+			file.content = rng.next();
+			originals.push_back(files.size());
+		}
+
+		int rc = write_file(file);
+
+		if ( rc ) {
+			fprintf(stderr,"%s: writing %s\n",strerror(rc),file.path.c_str());
+			exit(1);
+		}
+		files.push_back(file);
+		bytes += file.size;
+	}
+
+	FILE *f = fopen((top + "/TREEGEN.json").c_str(),"w");
+
+	if ( !f ) {
+		fprintf(stderr,"%s: writing %s/TREEGEN.json\n",strerror(errno),top.c_str());
+		exit(1);
+	}
+	fprintf(f,"{\"seed\":%llu,\"files\":%u,\"bytes\":%llu,\"dirs\":%zu,"
+		"\"dups\":%llu,\"prefix_twins\":%llu,\"hardlinks\":%llu,\"sizes\":\"%s\"}\n",
+		(unsigned long long)opt_seed,opt_files,(unsigned long long)bytes,dirs.size(),
+		(unsigned long long)ndups,(unsigned long long)nprefix,(unsigned long long)nlinks,
+		opt_sizes.c_str());
+	fclose(f);
+
+	printf("%s: %u files (%llu copies, %llu prefix twins, %llu links), %.1f MB in %zu directories\n",
+		top.c_str(),opt_files,(unsigned long long)ndups,(unsigned long long)nprefix,
+		(unsigned long long)nlinks,bytes / 1048576.0,dirs.size());
+	return 0;
+}
+
+// End treegen.cpp
@@ -0,0 +1,210 @@
+//////////////////////////////////////////////////////////////////////
+// candidates.cpp -- Flat, radix sorted table of duplicate candidates
+// Date: Mon Oct 19 09:30:18 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <array>
+#include <thread>
+
+#include "candidates.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Run func(px) for each of nparts parts, on a thread each
+//////////////////////////////////////////////////////////////////////
+
+void
+CandidateTable::run(unsigned nparts,const std::function<void(unsigned)>& func) {
+	std::vector<std::thread> tvec;
+
+	if ( nparts == 1 ) {
+		func(0);
+		return;
+	}
+	for ( unsigned px=0; px < nparts; ++px )
+		tvec.emplace_back(func,px);
+	for ( auto& thread : tvec )
+		thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Stable LSD radix sort on key(rec). Each part of the table counts
+// its digits, and then moves its records to where the counts of all
+// the parts before it say they go.
+//////////////////////////////////////////////////////////////////////
+
+template<typename K>
+void
+CandidateTable::radix_sort(K key) {
+	const size_t n = recs.size();
+
+	if ( n < 2 )
+		return;
+
+	const unsigned nparts = n >= parallel_min ? nthreads : 1;
+	const uint64_t key0 = key(recs[0]);
+	std::vector<std::array<size_t,256>> counts(nparts);
+	std::vector<s_candidate> tmp;
+	uint64_t diff = 0;		// Bits that differ from key0
+
+	for ( auto& rec : recs )
+		diff |= key(rec) ^ key0;
+
+	auto first = [&](unsigned px) { return n * px / nparts; };
+
+	for ( unsigned shift=0; shift < 64; shift += 8 ) {
+		if ( ((diff >> shift) & 0xFF) == 0 )
+			continue;	// Same in every record
+		if ( tmp.empty() )
+			tmp.resize(n);
+
+		run(nparts,[&](unsigned px) {
+			auto& count = counts[px];
+
+			count.fill(0);
+			for ( size_t rx=first(px); rx < first(px+1); ++rx )
+				++count[(key(recs[rx]) >> shift) & 0xFF];
+		});
+
+		size_t offset = 0;
+
+		for ( unsigned dx=0; dx < 256; ++dx )
+			for ( unsigned px=0; px < nparts; ++px ) {
+				const size_t count = counts[px][dx];
+
+				counts[px][dx] = offset;
+				offset += count;
+			}
+
+		run(nparts,[&](unsigned px) {
+			auto& next = counts[px];
+
+			for ( size_t rx=first(px); rx < first(px+1); ++rx )
+				tmp[next[(key(recs[rx]) >> shift) & 0xFF]++] = recs[rx];
+		});
+		recs.swap(tmp);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Sort by size, or by size and then key
+//////////////////////////////////////////////////////////////////////
+
+void
+CandidateTable::sort(bool by_key) {
+
+	if ( by_key )
+		radix_sort([](const s_candidate& rec) { return uint64_t(rec.key); });
+	radix_sort([](const s_candidate& rec) { return uint64_t(rec.size); });
+}
+
+//////////////////////////////////////////////////////////////////////
+// Drop the records alone in their run (the table must be sorted
+// the same way). Returns the records left.
+//////////////////////////////////////////////////////////////////////
+
+size_t
+CandidateTable::drop_singletons(bool by_key) {
+	size_t out = 0;
+
+	for_each_run(by_key,[&](size_t from,size_t to) {
+		if ( to - from < 2 )
+			return;
+		while ( from < to )
+			recs[out++] = recs[from++];
+	});
+	recs.resize(out);
+	recs.shrink_to_fit();
+	return out;
+}
+
+void
+CandidateTable::drop_if(const std::function<bool(const s_candidate&)>& pred) {
+
+	recs.erase(std::remove_if(recs.begin(),recs.end(),pred),recs.end());
+}
+
+#ifdef UNIT_TEST
+
+//////////////////////////////////////////////////////////////////////
+// make test: the radix sort against std::stable_sort, on one thread
+// and in parallel, with keys that do and do not share bytes; and
+// the runs and singletons found after it
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <map>
+#include <random>
+
+static unsigned nchecks = 0, nfailed = 0;
+
+static void
+check(bool ok,const char *what,size_t n,unsigned nthreads) {
+
+	++nchecks;
+	if ( !ok ) {
+		fprintf(stderr,"FAILED: %s (%zu records, %u threads)\n",what,n,nthreads);
+		++nfailed;
+	}
+}
+
+static bool
+equal(CandidateTable& table,const std::vector<s_candidate>& ref) {
+
+	if ( table.size() != ref.size() )
+		return false;
+	for ( size_t rx=0; rx < ref.size(); ++rx )
+		if ( table[rx].size != ref[rx].size || table[rx].key != ref[rx].key || table[rx].file != ref[rx].file )
+			return false;
+	return true;
+}
+
+int
+main() {
+	std::mt19937_64 rng(1);
+
+	for ( size_t n : { 0, 1, 2, 1000, 70000, 200000 } )
+		for ( unsigned nthreads : { 1, 4 } )
+			for ( uint64_t mask : { 0x3FULL, 0x7FFF00000000FF00ULL, ~0ULL >> 1 } ) {
+				CandidateTable table(nthreads);
+				std::vector<s_candidate> ref;
+
+				for ( size_t rx=0; rx < n; ++rx ) {
+					const s_candidate rec = { off_t(rng() & mask), rng() & mask & 0xFFFF, Fileno_t(rx + 1) };
+
+					table.add(rec.size,rec.key,rec.file);
+					ref.push_back(rec);
+				}
+
+				table.sort(false);
+				std::stable_sort(ref.begin(),ref.end(),[](const s_candidate& a,const s_candidate& b) {
+					return a.size < b.size;
+				});
+				check(equal(table,ref),"sort by size",n,nthreads);
+
+				table.sort(true);
+				std::stable_sort(ref.begin(),ref.end(),[](const s_candidate& a,const s_candidate& b) {
+					return a.size < b.size || (a.size == b.size && a.key < b.key);
+				});
+				check(equal(table,ref),"sort by size and key",n,nthreads);
+
+				std::map<std::pair<off_t,fprint_t>,size_t> counts;
+				std::vector<s_candidate> kept;
+
+				for ( auto& rec : ref )
+					++counts[{ rec.size, rec.key }];
+				for ( auto& rec : ref )
+					if ( counts[{ rec.size, rec.key }] > 1 )
+						kept.push_back(rec);
+
+				check(table.for_each_run(true,[](size_t,size_t) {}) == counts.size(),"runs",n,nthreads);
+				check(table.drop_singletons(true) == kept.size() && equal(table,kept),"drop singletons",n,nthreads);
+			}
+
+	printf("test_candidates: %u checks, %u failed\n",nchecks,nfailed);
+	return nfailed != 0;
+}
+
+#endif // UNIT_TEST
+
+// End candidates.cpp
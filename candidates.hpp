@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////
+// candidates.hpp -- Flat, radix sorted table of duplicate candidates
+// Date: Mon Oct 19 09:12:40 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef CANDIDATES_HPP
+#define CANDIDATES_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+#include <functional>
+
+#include "system.hpp"
+
+struct s_candidate {
+	off_t		size;
+	fprint_t	key;		// Fingerprint, then probes
+	Fileno_t	file;
+};
+
+//////////////////////////////////////////////////////////////////////
+// One record per candidate file. Between stages the table is radix
+// sorted (LSD, a byte at a time, skipping bytes that are the same in
+// every key) on opt_threads threads, and runs of one file are
+// dropped in place, so that each stage is a linear scan over the
+// runs left: by size alone, or by size and key.
+//////////////////////////////////////////////////////////////////////
+
+class CandidateTable {
+	static const size_t parallel_min = 65536;	// Records to sort in parallel
+
+	std::vector<s_candidate> recs;
+	unsigned		nthreads;
+
+	template<typename K> void radix_sort(K key);
+	void run(unsigned nparts,const std::function<void(unsigned)>& func);
+
+	static bool same(const s_candidate& a,const s_candidate& b,bool by_key) {
+		return a.size == b.size && (!by_key || a.key == b.key);
+	}
+
+public:	CandidateTable(unsigned nthreads=1) : nthreads(nthreads ? nthreads : 1) {}
+
+	void reserve(size_t n) { recs.reserve(n); }
+	void add(off_t size,fprint_t key,Fileno_t file) { recs.push_back({ size, key, file }); }
+	size_t size() const { return recs.size(); }
+	s_candidate& operator[](size_t rx) { return recs[rx]; }
+	std::vector<s_candidate>::iterator begin() { return recs.begin(); }
+	std::vector<s_candidate>::iterator end() { return recs.end(); }
+
+	void sort(bool by_key);
+	size_t drop_singletons(bool by_key);
+	void drop_if(const std::function<bool(const s_candidate&)>& pred);
+
+	// Call func(begin,end) for each run of records, by size or by size and key
+	template<typename F> size_t for_each_run(bool by_key,F func) {
+		size_t nruns = 0;
+
+		for ( size_t rx=0; rx < recs.size(); ++nruns ) {
+			size_t end = rx + 1;
+
+			while ( end < recs.size() && same(recs[rx],recs[end],by_key) )
+				++end;
+			func(rx,end);
+			rx = end;
+		}
+		return nruns;
+	}
+};
+
+#endif // CANDIDATES_HPP
+
+// End candidates.hpp
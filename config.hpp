@@ -12,6 +12,21 @@
 #define ST_MTIMESPEC	0
 #endif
 
+#if defined(__linux__)
+#define ST_MTIM		1	// struct stat has st_mtim
+#else
+#define ST_MTIM		0
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING	1	// Raw io_uring syscalls
+#endif
+#endif
+#ifndef HAVE_IO_URING
+#define HAVE_IO_URING	0
+#endif
+
 #endif // CONFIG_HPP
 
 // End config.hpp
@@ -12,9 +12,24 @@
 #include <assert.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <sys/resource.h>
+#include <limits.h>
 
 #include "system.hpp"
 #include "dir.hpp"
+#include "fpcache.hpp"
+#include "sched.hpp"
+#include "extsort.hpp"
+#include "output.hpp"
+#include "action.hpp"
+#include "ioengine.hpp"
+#include "device.hpp"
+#include "uring.hpp"
+#include "metrics.hpp"
+#include "progress.hpp"
+#include "candidates.hpp"
+#include "pipeline.hpp"
+#include "filter.hpp"
 
 #pragma GCC diagnostic ignored "-Wunused-variable"
 
@@ -22,6 +37,11 @@
 #include <vector>
 #include <set>
 #include <map>
+#include <unordered_set>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <chrono>
 
 static const char *version = "0.1";
 
@@ -31,86 +51,1635 @@ int exit_code = 0;
 static int opt_version = 0;
 static int opt_help = 0;
 static int opt_threads = 0;
-static uint64_t opt_size = 0;
+static uint64_t opt_size = 0;			// Smallest file, -s
+static uint64_t opt_max_size = 0;		// Largest file, else 0
+static PathFilter opt_filter;			// --include, --exclude
+static unsigned opt_max_depth = UINT_MAX;	// Levels below a root
+static bool opt_one_fs = false;			// --one-file-system
+static int opt_verify = 0;
+static int opt_exact = 0;
+static const s_hashkern *hashkern = nullptr;
+static const char *opt_cache = nullptr;
+static unsigned opt_cache_keep = 3;
+static uint64_t opt_mem_limit = 0;		// MB, spill to disk when non-zero
+static const char *opt_spill_dir = nullptr;
+static Format opt_format = Format::Text;
+static Action opt_action = Action::None;
+static bool opt_cache_sample = false;		// --pagecache given
+static const size_t max_cache_sample = 4096;	// Files
+static unsigned opt_dev_threads = 1;		// Readers per rotational disk
+static bool opt_stats = false;			// --stats report
+static bool opt_stats_json = false;
+static unsigned opt_progress = 0;		// Seconds between progress lines
+static const char *opt_progress_socket = nullptr;
+static bool opt_pipeline = true;		// Overlap the stages (--no-pipeline)
+static const unsigned uring_prefix_depth = 128;	// Files in flight per thread
+static const unsigned uring_hash_depth = 16;
+static const size_t uring_hash_mem = 64 * 1024 * 1024; // Most buffer per thread
 
 Uid<Fileno_t> uid_pool;
 Names name_pool;
+DirTree dir_tree;
 Uid<dup_t> dup_pool;
 
 static GlobalFiles global_files(uid_pool);
-static Queue<std::string> dir_queue;
+static FpCache fpcache;
+static NameLog ext_names;			// File names, with --mem-limit
+static ExtSort ext_scan;			// Scan records, with --mem-limit
+static DupWriter dup_writer;
+static DupAction dup_action;
+static CacheSample cache_sample;		// With --pagecache
+static Progress progress;
+static Devices devices;
+static std::atomic<uint64_t> uring_submits(0), uring_sqes(0), uring_bytes(0);
 
 std::vector<std::thread> thvec;
-std::atomic<time_t> dive_depth(0);
 
+//////////////////////////////////////////////////////////////////////
+// A directory to be examined. When fd >= 0, it was already opened
+// relative to its parent with Dir::open_subdir().
+//////////////////////////////////////////////////////////////////////
+
+struct s_dirwork {
+	std::string	path;		// Absolute pathname
+	Dirno_t		node;		// Node in dir_tree
+	int		fd = -1;	// Open directory, else -1
+	unsigned	depth = 0;	// Levels below the root
+	unsigned	rootlen = 0;	// Length of the root's pathname
+	dev_t		dev = 0;	// Device of the root
+};
+
+static WorkStealer<s_dirwork> dir_sched;
+static std::atomic<long> dirfd_budget(0); // Directory fds we may hold open
+static Pipeline pipeline;			// Unless --no-pipeline
+
+static void pipe_register(Fileno_t file,off_t size);
+
+//////////////////////////////////////////////////////////////////////
+// True when a file of size is within -s/--size and --max-size
+//////////////////////////////////////////////////////////////////////
+
+static inline bool
+size_wanted(off_t size) {
+
+	return (opt_size == 0 || off_t(opt_size) <= size)
+		&& (opt_max_size == 0 || size <= off_t(opt_max_size));
+}
+
+//////////////////////////////////////////////////////////////////////
+// Queue a directory, counted by the pipeline when there is one
+//////////////////////////////////////////////////////////////////////
+
+static void
+push_dir(unsigned thx,const s_dirwork& work) {
+
+	if ( opt_pipeline )
+		pipeline.push([&]() { dir_sched.push(thx,work); });
+	else	dir_sched.push(thx,work);
+}
+
+static void
+dive_dir(const s_dirwork& work,unsigned thx) {
+	Dir dir;
+	struct stat sbuf;
+	unsigned char d_type;
+	const char *name;
+	Fileno_t fileno;
+	int rc;
+
+	// Full pathnames are only built for directories and messages
+	auto entry_path = [&]() -> std::string {
+		std::string path(work.path);
+
+		path += '/';
+		path += name;
+		return path;
+	};
+
+	if ( work.fd >= 0 ) {
+		++dirfd_budget;
+		rc = dir.open(work.fd,work.path.c_str());
+	} else	rc = dir.open(work.path.c_str());
+
+	if ( rc ) {
+		fprintf(stderr,"%s: opening directory %s\n",
+			strerror(rc),
+			work.path.c_str());
+		exit_code |= 2;
+		return;
+	}
+	metrics.add(Metric::Dirs);
+	tracef(2,"Examining dir %s\n",work.path.c_str());
+
+	// Stat the entry, taking its type from the result
+	auto stat_entry = [&]() -> bool {
+		if ( Dir::stat_at(dir.fd(),name,sbuf) != 0 ) {
+			fprintf(stderr,"%s: stat(2) on '%s'\n",strerror(errno),entry_path().c_str());
+			return false;
+		}
+		d_type = S_ISREG(sbuf.st_mode) ? DT_REG
+			: S_ISDIR(sbuf.st_mode) ? DT_DIR
+			: S_ISLNK(sbuf.st_mode) ? DT_LNK : DT_UNKNOWN;
+		return true;
+	};
+
+	// Skip an entry before it costs a stat, or a subtree its getdents
+	auto pruned = [&](const char *why) {
+		metrics.add(Metric::Pruned);
+		if ( opt_verbose >= 2 )
+			tracef(2,"Pruned %s (%s)\n",entry_path().c_str(),why);
+	};
+
+	while ( (name = dir.next(d_type)) != nullptr ) {
+		bool stated = false;
+
+		if ( name[0] == '.' )
+			continue;		// Hidden entries are not examined
+
+		// Only regular files (or unknown types) need metadata
+		if ( d_type == DT_UNKNOWN ) {
+			if ( !stat_entry() )
+				continue;
+			stated = true;
+		}
+
+		if ( !opt_filter.empty() && (d_type == DT_REG || d_type == DT_DIR) ) {
+			std::string relpath;
+
+			if ( opt_filter.needs_path() ) {
+				if ( work.path.size() > work.rootlen )
+					relpath.assign(work.path,work.rootlen + 1,std::string::npos).append("/");
+				relpath += name;
+			}
+			if ( opt_filter.excluded(name,relpath,d_type == DT_DIR) ) {
+				pruned("excluded");
+				continue;
+			}
+		}
+
+		if ( d_type == DT_REG && !stated && !stat_entry() )
+			continue;
+
+		if ( d_type == DT_REG ) {
+			if ( size_wanted(sbuf.st_size) ) {
+				if ( opt_mem_limit > 0 ) {
+					s_extrec rec;
+
+					rec.size = sbuf.st_size;
+					rec.fprint = 0;
+					rec.dev = sbuf.st_dev;
+					rec.ino = sbuf.st_ino;
+					rec.dir = work.node;
+					if ( ext_names.append(thx,name,rec) )
+						ext_scan.add(thx,rec);	// Errors are reported later
+					metrics.add(Metric::Files);
+					if ( opt_verbose >= 3 )
+						tracef(3,"file %s\n",entry_path().c_str());
+				} else	{
+					bool linked = false;
+
+					fileno = global_files.add(work.node,name,sbuf,&linked);
+					if ( opt_verbose >= 3 )
+						tracef(3,"%ld: file %s\n",long(fileno),entry_path().c_str());
+					if ( opt_pipeline && !linked )
+						pipe_register(fileno,sbuf.st_size);
+				}
+			}
+		} else if ( d_type == DT_DIR ) {
+			s_dirwork sub;
+
+			if ( work.depth >= opt_max_depth ) {
+				pruned("--max-depth");
+				continue;
+			}
+
+			// Stat it by name before opening it, so that a filesystem
+			// mounted there (or to be automounted) is not entered
+			if ( opt_one_fs ) {
+				if ( !stated && (!stat_entry() || d_type != DT_DIR) )
+					continue;
+				if ( sbuf.st_dev != work.dev ) {
+					pruned("--one-file-system");
+					continue;
+				}
+			}
+
+			sub.depth = work.depth + 1;
+			sub.rootlen = work.rootlen;
+			sub.dev = work.dev;
+			if ( --dirfd_budget >= 0 ) {
+				sub.fd = Dir::open_subdir(dir.fd(),name);
+				if ( sub.fd < 0 )
+					++dirfd_budget;	// Retry by path, reporting any error
+			} else	++dirfd_budget;
+			sub.path = entry_path();
+			sub.node = dir_tree.add(work.node,name_pool.name_register(name));
+			push_dir(thx,sub);
+			metrics.peak(Peak::DirQueue,dir_sched.size());
+		} else if ( opt_verbose >= 2 ) {
+			if ( d_type == DT_LNK )
+				tracef(2,"Ignoring symlink %s\n",entry_path().c_str());
+			else	tracef(2,"Ignoring %s\n",entry_path().c_str());
+		}
+	}
+
+	if ( dir.error_code() != 0 ) {
+		fprintf(stderr,"%s: Reading directory %s\n",
+			strerror(dir.error_code()),work.path.c_str());
+		exit_code |= 2;
+	}
+	dir.close();
+}
+
+static void
+dive(unsigned thx) {
+	s_dirwork work;
+
+	while ( dir_sched.pop(thx,work) ) {
+		dive_dir(work,thx);
+		dir_sched.done();
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run func(thx) on opt_threads threads and wait for them all.
+//////////////////////////////////////////////////////////////////////
+
+static void
+parallel(const std::function<void(unsigned)>& func) {
+	std::vector<std::thread> tvec;
+
+	for ( int thx=0; thx < opt_threads; ++thx )
+		tvec.emplace_back(std::thread(func,unsigned(thx)));
+	for ( auto& thread : tvec )
+		thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Reads are scheduled per disk: opt_dev_threads at a time on a
+// rotational disk, any number elsewhere. Within a disk they are
+// ordered by inode number, or for whole file reads on a rotational
+// disk, by the physical offset of the file's first extent.
+//////////////////////////////////////////////////////////////////////
+
+static unsigned
+dev_limit(uint64_t disk) {
+	return devices.lookup(dev_t(disk)).rotational ? opt_dev_threads : 0;
+}
+
+static uint64_t
+read_disk(Fileno_t file) {
+	return devices.lookup(global_files.st_dev(file)).disk;
+}
+
+static uint64_t
+read_key(Fileno_t file,bool whole) {
+	uint64_t offset;
+
+	if ( whole && devices.lookup(global_files.st_dev(file)).rotational
+	  && Devices::physical(global_files.pathname(file),offset) )
+		return offset;
+	return global_files.st_ino(file);
+}
+
+//////////////////////////////////////////////////////////////////////
+// End a phase of the run, for --stats, and trace the time it took
+// (-v). bench/bench_run reads these lines. Phase next follows.
+//////////////////////////////////////////////////////////////////////
+
+static void
+phase_done(const char *name,const char *next=nullptr) {
+
+	tracef(1,"Phase %s: %.3f s\n",name,metrics.phase(name,next));
+}
+
+//////////////////////////////////////////////////////////////////////
+// With --io uring, a ring for this thread (false when it cannot be
+// set up, and the blocking path is taken). Its counts are added up
+// when it is done.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+uring_open(Uring& ring,unsigned depth,size_t bufsiz) {
+
+	if ( FileReader::engine != IoEngine::Uring )
+		return false;
+	return ring.open(depth,bufsiz,FileReader::pagecache == PageCache::Direct) == 0;
+}
+
+static void
+uring_close(Uring& ring) {
+
+	uring_submits += ring.stats.submits;
+	uring_sqes += ring.stats.sqes;
+	uring_bytes += ring.stats.bytes;
+	ring.close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fingerprint the first size (<= 1k) bytes of a file. Returns 0, or
+// errno. Most files go no further than this, so the reader is opened
+// for a prefix, with readahead turned off for the descriptor rather
+// than reading well past the prefix.
+//////////////////////////////////////////////////////////////////////
+
+static int
+prefix_fprint(const std::string& path,size_t size,fprint_t& fprint) {
+	FileReader rd;
+	const char *data;
+	ssize_t rc;
+
+	assert(size <= 1024);
+	if ( rd.open(path.c_str(),0,true) == -1 ) {
+		fprintf(stderr,"%s: opening %s for fingerprint\n",strerror(rd.error),path.c_str());
+		return rd.error;
+	}
+
+	rc = rd.read(0,size,data);
+	if ( rc != ssize_t(size) )
+		return rc == -1 ? rd.error : EIO;
+
+	fprint = hashkern->func(data,size);
+	metrics.add(Metric::Fingerprints);
+	metrics.add(Metric::FprintBytes,size);
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Record the fingerprint read for fileno, or its error rc
+//////////////////////////////////////////////////////////////////////
+
+static void
+fprinted(Fileno_t fileno,int rc) {
+
+	global_files.error(fileno) = rc;
+	if ( rc )
+		global_files.fprint(fileno) = 0;
+	else	global_files.lookup(fileno).fprint_ok = true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Fingerprint the first size (<= 1k) bytes of fileno, from the
+// cache when it has them. Returns true when the fingerprint is good.
+//////////////////////////////////////////////////////////////////////
+
+static bool
+fprint_file(Fileno_t fileno,size_t size) {
+
+	if ( fpcache.is_open() && fpcache.lookup_fprint(global_files,fileno) ) {
+		global_files.error(fileno) = 0;
+		return true;
+	}
+
+	int rc = prefix_fprint(global_files.pathname(fileno),size,global_files.fprint(fileno));
+
+	fprinted(fileno,rc);
+	return rc == 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Probe stages (--probe). Candidates sharing a size and fingerprint
+// are probed at a few more places before they are read in full: the
+// head, the tail, or n blocks spread evenly through the file. Blocks
+// start at probe_blksiz, and a bucket still holding probe_grow or
+// more files after a stage probes with blocks four times as large
+// at the next. A stage that would read more than a quarter of a
+// file is skipped for it.
+//////////////////////////////////////////////////////////////////////
+
+struct s_probe {
+	enum Kind { Head, Tail, Spread } kind;
+	unsigned	nblocks;		// Spread
+};
+
+static std::vector<s_probe> opt_probes = {
+	{ s_probe::Head, 1 }, { s_probe::Tail, 1 }, { s_probe::Spread, 4 }
+};
+static const size_t probe_blksiz = 4096;	// To start with
+static const size_t probe_max_blksiz = 256 * 1024;
+static const size_t probe_grow = 8;		// Files left in a bucket
+
+static bool
+parse_probes(const char *spec,std::vector<s_probe>& probes) {
+	std::string list(spec);
+	size_t from = 0;
+
+	probes.clear();
+	if ( list == "none" )
+		return true;
+
+	while ( from <= list.size() ) {
+		size_t to = list.find(',',from);
+
+		if ( to == std::string::npos )
+			to = list.size();
+
+		const std::string stage = list.substr(from,to - from);
+		char *ep;
+		unsigned long n;
+
+		if ( stage == "head" )
+			probes.push_back({ s_probe::Head, 1 });
+		else if ( stage == "tail" )
+			probes.push_back({ s_probe::Tail, 1 });
+		else if ( (n = strtoul(stage.c_str(),&ep,10)) >= 1 && n <= 64 && !*ep )
+			probes.push_back({ s_probe::Spread, unsigned(n) });
+		else	return false;
+		from = to + 1;
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The blocks a probe reads from a file of size bytes, as (offset,
+// length) pairs. Offsets are page aligned, for O_DIRECT, so the tail
+// block runs a little long to reach the end of the file.
+//////////////////////////////////////////////////////////////////////
+
+static std::vector<std::pair<off_t,size_t>>
+probe_blocks(const s_probe& probe,off_t size,size_t blksiz) {
+	std::vector<std::pair<off_t,size_t>> blocks;
+	const off_t mask = ~off_t(4095);
+
+	switch ( probe.kind ) {
+	case s_probe::Head:
+		blocks.emplace_back(0,std::min(off_t(blksiz),size));
+		break;
+	case s_probe::Tail:
+		{
+			const off_t offset = std::max(off_t(0),size - off_t(blksiz)) & mask;
+
+			blocks.emplace_back(offset,size - offset);
+		}
+		break;
+	case s_probe::Spread:
+		for ( unsigned bx=1; bx <= probe.nblocks; ++bx ) {
+			const off_t centre = size / (probe.nblocks + 1) * bx;
+			const off_t offset = std::max(off_t(0),centre - off_t(blksiz / 2)) & mask;
+
+			blocks.emplace_back(offset,std::min(off_t(blksiz),size - offset));
+		}
+		break;
+	}
+	return blocks;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Hash the blocks of probes into fprint. Returns 0, or errno (a read
+// error, or EIO for a short read), after reporting it.
+//////////////////////////////////////////////////////////////////////
+
+static int
+probe_fprint(const std::string& path,off_t size,const std::vector<s_probe>& probes,size_t blksiz,fprint_t& fprint) {
+	FileReader rd;
+	const char *data;
+	ssize_t rc;
+
+	if ( rd.open(path.c_str(),blksiz + 4096,true) == -1 ) {
+		fprintf(stderr,"%s: opening %s for probe\n",strerror(rd.error),path.c_str());
+		return rd.error;
+	}
+
+	fprint = 0;
+	for ( auto& probe : probes )
+		for ( auto& block : probe_blocks(probe,size,blksiz) ) {
+			rc = rd.read(block.first,block.second,data);
+			if ( rc == -1 ) {
+				fprintf(stderr,"%s: reading %s for probe\n",strerror(rd.error),path.c_str());
+				return rd.error;
+			}
+			if ( rc != ssize_t(block.second) ) {
+				fprintf(stderr,"%s: short read at %lld for probe (file shrank?)\n",
+					path.c_str(),(long long)block.first);
+				return EIO;
+			}
+			fprint = xxh64(data,block.second,fprint);
+		}
+	metrics.add(Metric::Probes);
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Total bytes a probe reads of a file of size
+//////////////////////////////////////////////////////////////////////
+
+static size_t
+probe_bytes(const s_probe& probe,off_t size,size_t blksiz) {
+	size_t bytes = 0;
+
+	for ( auto& block : probe_blocks(probe,size,blksiz) )
+		bytes += block.second;
+	return bytes;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Apply any --action to a confirmed set (unless the kernel already
+// did in verifying it), then hand it to the writer thread.
+//////////////////////////////////////////////////////////////////////
+
+static void
+emit(s_dupset&& set,bool acted=false) {
+
+	if ( !acted )
+		dup_action.apply(set);
+	dup_writer.emit(std::move(set));
+}
+
+static void
+emit_dupset(size_t size,std::vector<Fileno_t>& files,bool acted=false) {
+	s_dupset set;
+
+	std::sort(files.begin(),files.end());
+	set.id = dup_pool.allocate();
+	set.size = size;
+	metrics.add(Metric::DupFiles,files.size());
+
+	for ( auto file : files ) {
+		global_files.duplicate(file) = set.id;
+		set.files.emplace_back();
+
+		s_dupfile& dfile = set.files.back();
+
+		dfile.path = global_files.pathname(file);
+		for ( auto& link : global_files.links(file) )
+			dfile.links.push_back(global_files.pathname(link));
+	}
+	emit(std::move(set),acted);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Run the --probe stages over the size+fingerprint runs of table, on
+// opt_threads workers reading per disk. Each file probed is keyed by
+// what it read, the table is sorted again, and files left on their
+// own are dropped. Runs of probe_grow or more files read blocks 4x
+// larger at each stage. What is left goes on to verify_candidates().
+//////////////////////////////////////////////////////////////////////
+
+static void
+probe_candidates(CandidateTable& table) {
+	static const char *kinds[] = { "head", "tail", "spread" };
+	struct s_probe_work {
+		size_t			rx;		// Table record
+		size_t			blksiz;
+	};
+	size_t grown = probe_blksiz;			// Block size of large runs
+
+	for ( auto& probe : opt_probes ) {
+		DeviceScheduler<s_probe_work> sched(dev_limit);
+		std::vector<fprint_t> results(table.size());
+		std::vector<char> probed(table.size(),0);
+
+		table.for_each_run(true,[&](size_t from,size_t to) {
+			const off_t size = table[from].size;
+			const size_t blksiz = to - from >= probe_grow ? grown : probe_blksiz;
+
+			if ( probe_bytes(probe,size,blksiz) * 4 > size_t(size) )
+				return;		// Read it all instead
+
+			for ( size_t rx=from; rx < to; ++rx ) {
+				const Fileno_t file = table[rx].file;
+
+				probed[rx] = 1;
+				sched.push(read_disk(file),read_key(file,false),s_probe_work{ rx, blksiz });
+			}
+		});
+		if ( sched.size() == 0 )
+			continue;
+		metrics.peak(Peak::ReadQueue,sched.size());
+
+		parallel([&](unsigned thx) {
+			s_probe_work work;
+			uint64_t disk;
+
+			while ( sched.pop(work,disk) ) {
+				const s_candidate& rec = table[work.rx];
+				int rc = probe_fprint(global_files.pathname(rec.file),rec.size,
+					std::vector<s_probe>(1,probe),work.blksiz,results[work.rx]);
+
+				if ( rc )
+					global_files.error(rec.file) = rc;
+				sched.done(disk);
+			}
+		});
+
+		// Regroup by what the probe read
+		for ( size_t rx=0; rx < table.size(); ++rx )
+			if ( probed[rx] )
+				table[rx].key = xxh64(&results[rx],sizeof results[rx],table[rx].key);
+		table.drop_if([](const s_candidate& rec) { return global_files.error(rec.file) != 0; });
+		table.sort(true);
+		table.drop_singletons(true);
+		grown = std::min(grown * 4,probe_max_blksiz);
+
+		const size_t nbuckets = table.for_each_run(true,[](size_t,size_t) {});
+
+		if ( probe.kind == s_probe::Spread )
+			tracef(1,"Probe %u blocks: %ld files left in %ld buckets\n",
+				probe.nblocks,long(table.size()),long(nbuckets));
+		else	tracef(1,"Probe %s: %ld files left in %ld buckets\n",
+				kinds[probe.kind],long(table.size()),long(nbuckets));
+	}
+
+	metrics.add(Metric::ProbeCandidates,table.size());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Record the outcome of hashing file into its hash
+//////////////////////////////////////////////////////////////////////
+
+static void
+hashed(Fileno_t file,int error) {
+	s_file_ent& fent = global_files.lookup(file);
+
+	metrics.add(Metric::VerifiedBytes,uint64_t(global_files.st_size(file)));
+	if ( error ) {
+		global_files.error(file) = error;
+		fprintf(stderr,"%s: hashing %s\n",
+			strerror(error),
+			global_files.pathname(file).c_str());
+		return;
+	}
+	fent.hash_ok = true;
+	metrics.add(Metric::Hashes);
+	tracef(2,"    %016llX%016llX %s\n",
+		(unsigned long long)fent.hash.h1,
+		(unsigned long long)fent.hash.h2,
+		global_files.pathname(file).c_str());
+}
+
+//////////////////////////////////////////////////////////////////////
+// Take the hash of file from the cache, if it is there
+//////////////////////////////////////////////////////////////////////
+
+static bool
+cached_hash(Fileno_t file) {
+
+	if ( !fpcache.is_open() || !fpcache.lookup_hash(global_files,file) )
+		return false;
+	metrics.add(Metric::VerifiedBytes,uint64_t(global_files.st_size(file)));
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read each candidate exactly once: files already hashed by the
+// pipeline (or found in the cache) are not read again.
+//////////////////////////////////////////////////////////////////////
+
+static void
+hash_file(Fileno_t file) {
+
+	if ( global_files.lookup(file).hash_ok || cached_hash(file) )
+		return;
+
+	bool ok = global_files.content_hash(file,global_files.lookup(file).hash);
+
+	hashed(file,ok ? 0 : errno ? errno : EIO);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Final verification of size+fingerprint buckets, on opt_threads workers.
+//
+// By default each candidate is hashed as its own work item, so a
+// large bucket is spread over all threads, and the worker hashing
+// the last file of a bucket groups it by hash. With --exact (or for
+// --verify of hash groups) each group is a work item for
+// compare_group(), and groups of split_min or more files are put
+// back on the queue as soon as they divide by content. A group of
+// twice split_min or more is split up front, into a part per thread
+// that each hold its first file: the parts are compared at the same
+// time, and their classes holding that file merged. The files left
+// over, unequal to it, are compared again as one group.
+//
+// With --action dedupe and neither --verify nor --exact, buckets on
+// a single device are instead handed to FIDEDUPERANGE, which
+// compares the data in the kernel as it shares it. Each round shares
+// the files equal to the first with it, and the files that differ go
+// round again only while rounds at least halve them: the rest are
+// left to compare_group(), as is a bucket on a filesystem without
+// support.
+//
+// Work is queued on the disk of its (first) file, with compare and
+// kernel work going ahead of hashing. Each duplicate set is emitted
+// as soon as it is confirmed, while other buckets are still being
+// verified.
+//////////////////////////////////////////////////////////////////////
+
+static void
+verify_candidates(CandidateTable& table) {
+	static const size_t split_min = 8;
+	struct s_bucket {
+		size_t			size;
+		std::vector<Fileno_t>	files;
+		std::atomic<size_t>	left;		// Files not yet hashed
+	};
+	struct s_merge {
+		size_t			size;
+		Fileno_t		rep;		// In every part
+		std::atomic<size_t>	left;		// Parts not yet compared
+		std::mutex		mutex;
+		std::vector<Fileno_t>	same;		// Equal to rep
+		std::vector<Fileno_t>	rest;		// Not, or not yet known
+	};
+	struct s_verify_work {
+		size_t			size;
+		off_t			offset;
+		std::vector<Fileno_t>	files;
+		bool			kernel;		// Verify with FIDEDUPERANGE
+		s_bucket		*bucket;	// Else hash files[0] of bucket
+		std::shared_ptr<s_merge> merge;		// Part of a group split up front
+	};
+	DeviceScheduler<s_verify_work> sched(dev_limit);
+	std::unique_ptr<s_bucket[]> buckets;
+	std::atomic<bool> kernel_warned(false);
+	const bool kernel = opt_action == Action::Dedupe && !opt_verify && !opt_exact;
+
+	auto push_work = [&](size_t size,off_t offset,std::vector<Fileno_t>&& files,bool kernel=false,
+	  std::shared_ptr<s_merge> merge=nullptr) {
+		s_verify_work work;
+		const uint64_t disk = read_disk(files[0]);
+
+		work.size = size;
+		work.offset = offset;
+		work.files = std::move(files);
+		work.kernel = kernel;
+		work.bucket = nullptr;
+		work.merge = std::move(merge);
+		sched.push(disk,0,std::move(work),true);
+		metrics.peak(Peak::ReadQueue,sched.size());
+	};
+
+	// Queue a group to compare, split up front when it is large
+	auto push_compare = [&](size_t size,std::vector<Fileno_t>&& files) {
+		const size_t nparts = std::min(size_t(opt_threads),files.size() / split_min);
+
+		if ( nparts < 2 ) {
+			push_work(size,0,std::move(files));
+			return;
+		}
+
+		std::shared_ptr<s_merge> merge(new s_merge);
+		const size_t n = files.size() - 1;
+
+		merge->size = size;
+		merge->rep = files[0];
+		merge->left = nparts;
+		metrics.add(Metric::VerifyBytes,uint64_t(size) * (nparts - 1));	// rep, again
+		for ( size_t px=0; px < nparts; ++px ) {
+			std::vector<Fileno_t> part(1,merge->rep);
+
+			part.insert(part.end(),files.begin() + 1 + n * px / nparts,files.begin() + 1 + n * (px + 1) / nparts);
+			push_work(size,0,std::move(part),false,merge);
+		}
+	};
+
+	auto push_hash = [&](Fileno_t file,s_bucket *bucket) {
+		s_verify_work work;
+
+		work.size = bucket->size;
+		work.offset = 0;
+		work.files.assign(1,file);
+		work.kernel = false;
+		work.bucket = bucket;
+		sched.push(read_disk(file),read_key(file,true),std::move(work));
+	};
+
+	// The files of a run of the table
+	auto run_files = [&](size_t from,size_t to) {
+		std::vector<Fileno_t> files;
+
+		for ( size_t rx=from; rx < to; ++rx )
+			files.push_back(table[rx].file);
+		return files;
+	};
+
+	// Files the pipeline hashed were counted as they were queued
+	for ( auto& rec : table )
+		if ( !global_files.lookup(rec.file).hash_ok )
+			metrics.add(Metric::VerifyBytes,uint64_t(rec.size));
+
+	if ( opt_exact ) {
+		// Byte compare whole buckets without hashing
+		table.for_each_run(true,[&](size_t from,size_t to) {
+			push_compare(table[from].size,run_files(from,to));
+		});
+		tracef(1,"Comparing %ld groups..\n",long(sched.size()));
+	} else	{
+		const size_t nbuckets = table.for_each_run(true,[](size_t,size_t) {});
+		size_t bx = 0;
+
+		buckets.reset(new s_bucket[nbuckets]);
+
+		table.for_each_run(true,[&](size_t from,size_t to) {
+			s_bucket& bucket = buckets[bx++];
+
+			bucket.size = table[from].size;
+			bucket.files = run_files(from,to);
+			bucket.left = bucket.files.size();
+
+			if ( kernel && std::all_of(bucket.files.begin(),bucket.files.end(),
+			  [&](Fileno_t file) {
+				return global_files.st_dev(file) == global_files.st_dev(bucket.files[0]);
+			}) ) {
+				push_work(bucket.size,0,std::move(bucket.files),true);
+				return;
+			}
+			for ( auto file : bucket.files )
+				push_hash(file,&bucket);
+		});
+
+		tracef(1,"Hashing %ld candidate files..\n",long(sched.size()));
+	}
+	metrics.peak(Peak::ReadQueue,sched.size());
+
+	// Let the kernel compare and share, peeling off one set at a time
+	auto kernel_verify = [&](s_verify_work& work) {
+		std::vector<Fileno_t> rest(std::move(work.files));
+
+		while ( rest.size() >= 2 ) {
+			std::vector<std::string> dests;
+			std::vector<int> status;
+			std::vector<Fileno_t> same(1,rest[0]), differs, failed;
+
+			for ( size_t fx=1; fx < rest.size(); ++fx )
+				dests.push_back(global_files.pathname(rest[fx]));
+
+			int rc = dup_action.dedupe(global_files.pathname(rest[0]),dests,work.size,status);
+
+			if ( rc ) {
+				if ( !kernel_warned.exchange(true) )
+					fprintf(stderr,"%s: FIDEDUPERANGE, comparing in userspace\n",strerror(rc));
+				push_work(work.size,0,std::move(rest));
+				return;
+			}
+
+			for ( size_t fx=1; fx < rest.size(); ++fx )
+				if ( status[fx-1] == DupAction::Same )
+					same.push_back(rest[fx]);
+				else if ( status[fx-1] == DupAction::Differs )
+					differs.push_back(rest[fx]);
+				else	failed.push_back(rest[fx]);
+
+			if ( !failed.empty() ) {
+				// Not shared, but may still be duplicates of rest[0]:
+				// compare them with it here, so it joins one set only
+				std::vector<Fileno_t> group(1,rest[0]);
+				std::unordered_set<Fileno_t> matched;
+				off_t offset = 0;
+
+				group.insert(group.end(),failed.begin(),failed.end());
+				for ( auto& eqclass : global_files.compare_group(group,offset) )
+					if ( std::find(eqclass.begin(),eqclass.end(),rest[0]) != eqclass.end() )
+						matched.insert(eqclass.begin(),eqclass.end());
+				metrics.add(Metric::Compares);
+
+				for ( auto file : failed )
+					if ( matched.count(file) )
+						same.push_back(file);
+					else if ( global_files.error(file) == 0 )
+						differs.push_back(file);	// Tried again with those
+			}
+
+			const size_t nverified = same.size();	// rest[0] and its copies
+
+			metrics.add(Metric::VerifiedBytes,uint64_t(work.size) * nverified);
+			if ( same.size() >= 2 )
+				emit_dupset(work.size,same,true);
+			if ( differs.size() >= 2 && differs.size() * 2 > rest.size() ) {
+				// Peeling sets off one at a time would go quadratic
+				push_work(work.size,0,std::move(differs));
+				return;
+			}
+			rest = std::move(differs);
+		}
+		if ( rest.size() == 1 )
+			metrics.add(Metric::VerifiedBytes,uint64_t(work.size));
+	};
+
+	// Split a fully hashed bucket by content hash
+	auto group_bucket = [&](s_bucket& bucket) {
+		std::map<hash128_t,std::vector<Fileno_t>> by_hash;
+
+		for ( auto file : bucket.files )
+			if ( global_files.error(file) == 0 )
+				by_hash[global_files.lookup(file).hash].push_back(file);
+
+		for ( auto& pair : by_hash ) {
+			auto& group = pair.second;
+
+			if ( group.size() < 2 )
+				continue;
+			if ( opt_verify ) {
+				// Read a second time, to compare
+				metrics.add(Metric::VerifyBytes,uint64_t(bucket.size) * group.size());
+				push_compare(bucket.size,std::move(group));
+			} else	emit_dupset(bucket.size,group);
+		}
+	};
+
+	// Gather the outcome of comparing a part of a group split up
+	// front. Once the last part is done, the files equal to the rep
+	// are emitted, and the rest compared among themselves.
+	auto merge_part = [&](s_verify_work& work,std::vector<std::vector<Fileno_t>>& classes,
+	  std::vector<std::vector<Fileno_t>>& split) {
+		s_merge& merge = *work.merge;
+		std::unordered_set<Fileno_t> out;	// Still in this part
+
+		for ( auto& group : split )
+			out.insert(group.begin(),group.end());
+		{
+			std::lock_guard<std::mutex> lock(merge.mutex);
+
+			for ( auto& eqclass : classes ) {
+				const bool same = std::find(eqclass.begin(),eqclass.end(),merge.rep) != eqclass.end();
+
+				for ( auto file : eqclass )
+					if ( file != merge.rep ) {
+						(same ? merge.same : merge.rest).push_back(file);
+						out.insert(file);
+					}
+			}
+			// Those left on their own here may match in another part
+			for ( auto file : work.files )
+				if ( file != merge.rep && !out.count(file) && global_files.error(file) == 0 )
+					merge.rest.push_back(file);
+		}
+
+		merge.left += split.size();
+		for ( auto& group : split )
+			push_work(work.size,work.offset,std::move(group),false,work.merge);
+		if ( --merge.left > 0 )
+			return;
+
+		if ( !merge.same.empty() ) {
+			merge.same.insert(merge.same.begin(),merge.rep);
+			emit_dupset(merge.size,merge.same);
+		}
+		if ( merge.rest.size() >= 2 ) {
+			metrics.add(Metric::VerifyBytes,uint64_t(merge.size) * merge.rest.size());
+			push_work(merge.size,0,std::move(merge.rest));
+		}
+	};
+
+	auto run = [&](s_verify_work& work) {
+		if ( work.bucket ) {
+			hash_file(work.files[0]);
+			if ( --work.bucket->left == 0 )
+				group_bucket(*work.bucket);
+		} else if ( work.kernel ) {
+			kernel_verify(work);
+		} else	{
+			std::vector<std::vector<Fileno_t>> split;
+			const off_t from = std::min(work.offset,off_t(work.size));
+			auto classes = global_files.compare_group(work.files,work.offset,
+				work.files.size() >= split_min ? &split : nullptr);
+			uint64_t verified = uint64_t(work.size - from) * work.files.size();
+
+			// Files split off resume from the offset reached
+			for ( auto& group : split )
+				verified -= uint64_t(work.size - std::min(work.offset,off_t(work.size))) * group.size();
+			metrics.add(Metric::Compares);
+			metrics.add(Metric::VerifiedBytes,verified);
+
+			if ( work.merge ) {
+				merge_part(work,classes,split);
+				return;
+			}
+			for ( auto& eqclass : classes )
+				emit_dupset(work.size,eqclass);
+			for ( auto& group : split )
+				push_work(work.size,work.offset,std::move(group));
+		}
+	};
+
+	// With --io uring, files are hashed uring_hash_depth at a time in
+	// the thread's ring, and other work is done in between
+	auto uring_run = [&](Uring& ring) {
+		std::vector<s_verify_work> inring(uring_hash_depth);
+		std::vector<uint64_t> disks(uring_hash_depth);
+		std::vector<unsigned> done;
+		s_verify_work work;
+		uint64_t disk;
+
+		auto start = [&]() {
+			const Fileno_t file = work.files[0];
+
+			if ( !work.bucket || cached_hash(file) ) {
+				run(work);
+				sched.done(disk);
+				return;
+			}
+
+			const unsigned slot = ring.whole(global_files.pathname(file));
+
+			inring[slot] = std::move(work);
+			disks[slot] = disk;
+		};
+
+		for (;;) {
+			while ( !ring.full() && sched.try_pop(work,disk) )
+				start();
+			if ( ring.inflight() == 0 ) {
+				if ( !sched.pop(work,disk) )
+					break;
+				start();
+				continue;
+			}
+
+			ring.wait(done);
+			for ( auto slot : done ) {
+				const Fileno_t file = inring[slot].files[0];
+
+				if ( !ring.error(slot) )
+					global_files.lookup(file).hash = ring.hash(slot);
+				hashed(file,ring.error(slot));
+				if ( --inring[slot].bucket->left == 0 )
+					group_bucket(*inring[slot].bucket);
+				sched.done(disks[slot]);
+			}
+		}
+	};
+
+	tracef(1,"Reading from %ld disks, %ld limited to %u threads\n",
+		long(sched.ndevices()),long(sched.nlimited()),opt_dev_threads);
+
+	parallel([&](unsigned thx) {
+		s_verify_work work;
+		uint64_t disk;
+		Uring ring;
+
+		if ( uring_open(ring,uring_hash_depth,std::min(FileReader::chunk,uring_hash_mem / uring_hash_depth)) ) {
+			uring_run(ring);
+			uring_close(ring);
+			return;
+		}
+
+		while ( sched.pop(work,disk) ) {
+			run(work);
+			sched.done(disk);
+		}
+	});
+}
+
+//////////////////////////////////////////////////////////////////////
+// Phased stages (--no-pipeline): once the walk is done, fingerprint
+// the files that share a size, leaving in table those that share a
+// size and fingerprint.
+//////////////////////////////////////////////////////////////////////
+
+static void
+fingerprint_candidates(CandidateTable& table) {
+
+	// One record per file, leaving those that share a size
+	table.reserve(global_files.size());
+	global_files.for_each([&](Fileno_t fileno) {
+		table.add(global_files.st_size(fileno),0,fileno);
+	});
+	table.sort(false);
+	table.drop_singletons(false);
+
+	{
+		struct s_size_qent {
+			Fileno_t	fileno;
+			size_t		size;
+			
+		};
+		DeviceScheduler<s_size_qent> inq(dev_limit);
+
+		// Queue up fingerprint work:
+		for ( auto& rec : table )
+			inq.push(read_disk(rec.file),read_key(rec.file,false),s_size_qent{ rec.file, size_t(rec.size) });
+		metrics.add(Metric::SizeCandidates,inq.size());
+		metrics.peak(Peak::ReadQueue,inq.size());
+
+		// With --io uring, uring_prefix_depth files at a time per thread
+		auto fprint_uring = [&](Uring& ring) {
+			std::vector<s_size_qent> inring(uring_prefix_depth);
+			std::vector<uint64_t> disks(uring_prefix_depth);
+			std::vector<unsigned> done;
+			s_size_qent qent;
+			uint64_t disk;
+
+			auto start = [&]() {
+				if ( fpcache.is_open() && fpcache.lookup_fprint(global_files,qent.fileno) ) {
+					global_files.error(qent.fileno) = 0;
+					inq.done(disk);
+					return;
+				}
+
+				const unsigned slot = ring.prefix(global_files.pathname(qent.fileno),
+					qent.size > 1024 ? 1024 : qent.size);
+
+				inring[slot] = qent;
+				disks[slot] = disk;
+			};
+
+			for (;;) {
+				while ( !ring.full() && inq.try_pop(qent,disk) )
+					start();
+				if ( ring.inflight() == 0 ) {
+					if ( !inq.pop(qent,disk) )
+						break;
+					start();
+					continue;
+				}
+
+				ring.wait(done);
+				for ( auto slot : done ) {
+					const Fileno_t fileno = inring[slot].fileno;
+					const size_t size = inring[slot].size > 1024 ? 1024 : inring[slot].size;
+					int rc = ring.error(slot);
+
+					if ( rc && !ring.opened(slot) )
+						fprintf(stderr,"%s: opening %s for fingerprint\n",
+							strerror(rc),global_files.pathname(fileno).c_str());
+					else if ( !rc && ring.bytes(slot) != size )
+						rc = EIO;
+					if ( !rc ) {
+						global_files.fprint(fileno) = hashkern->func(ring.data(slot),size);
+						metrics.add(Metric::Fingerprints);
+						metrics.add(Metric::FprintBytes,size);
+					}
+					fprinted(fileno,rc);
+					inq.done(disks[slot]);
+				}
+			}
+		};
+
+		auto fprint_func = [&]() {
+			s_size_qent qent;
+			uint64_t disk;
+			Uring ring;
+
+			if ( uring_open(ring,uring_prefix_depth,1024) ) {
+				fprint_uring(ring);
+				uring_close(ring);
+				return;
+			}
+
+			while ( inq.pop(qent,disk) ) {
+				fprint_file(qent.fileno,qent.size>1024?1024:qent.size);
+				inq.done(disk);
+			}
+		};
+
+		tracef(1,"Performing first 1k %s fingerprints on %ld files..\n",
+			hashkern->name,long(inq.size()));
+
+		std::vector<std::thread> tvec;
+		for ( int thx=0; thx < opt_threads; ++thx )
+			tvec.emplace_back(std::thread(fprint_func));
+
+		for ( auto& thread : tvec )
+			thread.join();
+		tvec.clear();
+		phase_done("fingerprint","group");
+
+		// Key each file by its fingerprint, dropping those not read
+		table.drop_if([](const s_candidate& rec) { return global_files.error(rec.file) != 0; });
+		for ( auto& rec : table ) {
+			rec.key = global_files.fprint(rec.file);
+			tracef(2,"File fprint %016llX size %9ld file %ld %s\n",
+				(unsigned long long)rec.key,long(rec.size),long(rec.file),
+				global_files.pathname(rec.file).c_str());
+		}
+	}
+
+	table.sort(true);
+
+	const size_t cancount = table.drop_singletons(true);
+
+	tracef(2,"Fingerprint Dup Candidates: %ld\n",long(cancount));
+	metrics.add(Metric::FprintCandidates,cancount);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Overlapped stages (unless --no-pipeline)
+//
+// Traversal, fingerprints, probes and hashes run at once, on the
+// same opt_threads workers. A file is fingerprinted as soon as a
+// second file of its size is registered, probed once another shares
+// its size and fingerprint, and hashed once another shares its
+// probes too. Reads are queued per disk as in the phased stages. A
+// worker takes from the latest stage it can, and a stage is only
+// fed while the queue after it holds under pipe_queue_max files, so
+// that the walk does not run far ahead of the reads.
+//
+// Probes read fixed probe_blksiz blocks, all in one work item, as
+// the size of a group is not known until the walk is done. Files
+// that reach the hash stage are recorded in pipe_finals, keyed by
+// size and probes, for verify_candidates() to group once every file
+// is in. With --exact, or --action dedupe verified by the kernel,
+// there is no hash stage: the groups are verified as a whole.
+//////////////////////////////////////////////////////////////////////
+
+struct s_pipe_read {
+	Fileno_t	file;
+	off_t		size;
+};
+
+static const size_t pipe_queue_max = 4096;	// Reads queued per stage
+static Collisions pipe_sizes;			// By size
+static Collisions pipe_fprints;			// By size, fingerprint
+static Collisions pipe_probed;			// By size, probes
+static DeviceScheduler<s_pipe_read> pipe_fprintq(dev_limit);
+static DeviceScheduler<s_pipe_read> pipe_probeq(dev_limit);
+static DeviceScheduler<s_pipe_read> pipe_hashq(dev_limit);
+static bool pipe_hashing = false;		// Hash stage runs
+static std::mutex pipe_mutex;
+static std::vector<s_candidate> pipe_finals;	// Files that reached the hash stage
+
+static void
+pipe_queue(DeviceScheduler<s_pipe_read>& queue,Fileno_t file,off_t size,bool whole) {
+
+	pipeline.push([&]() {
+		queue.push(read_disk(file),read_key(file,whole),s_pipe_read{ file, size });
+	});
+	metrics.peak(Peak::ReadQueue,queue.size());
+}
+
+//////////////////////////////////////////////////////////////////////
+// The probes taken at size: those reading at most a quarter of it
+//////////////////////////////////////////////////////////////////////
+
+static std::vector<s_probe>
+pipe_probes(off_t size) {
+	std::vector<s_probe> probes;
+
+	for ( auto& probe : opt_probes )
+		if ( probe_bytes(probe,size,probe_blksiz) * 4 <= size_t(size) )
+			probes.push_back(probe);
+	return probes;
+}
+
+// file shares its size and key (probes, or fingerprint) with another
 static void
-dive_dir(const std::string& directory) {
-	Dir dir;
-	std::string path;
-	struct stat sbuf;
-	Fileno_t fileno;
-	int rc;
+pipe_final(Fileno_t file,off_t size,fprint_t key) {
+
+	{
+		std::lock_guard<std::mutex> lock(pipe_mutex);
+
+		pipe_finals.push_back({ size, key, file });
+	}
+	metrics.add(Metric::ProbeCandidates);
+	if ( pipe_hashing ) {
+		metrics.add(Metric::VerifyBytes,uint64_t(size));
+		pipe_queue(pipe_hashq,file,size,true);
+	}
+}
+
+// file shares its size and fingerprint with another
+static void
+pipe_fprinted(Fileno_t file,off_t size) {
+
+	metrics.add(Metric::FprintCandidates);
+	if ( pipe_probes(size).empty() )
+		pipe_final(file,size,global_files.fprint(file));
+	else	pipe_queue(pipe_probeq,file,size,false);
+}
+
+// A file newly registered by the walk
+static void
+pipe_register(Fileno_t file,off_t size) {
+	Fileno_t out[2];
+	const unsigned n = pipe_sizes.add(size,0,file,out);
+
+	for ( unsigned ox=0; ox < n; ++ox ) {
+		metrics.add(Metric::SizeCandidates);
+		pipe_queue(pipe_fprintq,out[ox],size,false);
+	}
+}
+
+static void
+pipe_fprint(const s_pipe_read& work) {
+	Fileno_t out[2];
+
+	if ( !fprint_file(work.file,work.size > 1024 ? 1024 : work.size) )
+		return;
+
+	const fprint_t fprint = global_files.fprint(work.file);
+	const unsigned n = pipe_fprints.add(work.size,fprint,work.file,out);
+
+	tracef(2,"File fprint %016llX size %9ld file %ld %s\n",
+		(unsigned long long)fprint,long(work.size),long(work.file),
+		global_files.pathname(work.file).c_str());
+	for ( unsigned ox=0; ox < n; ++ox )
+		pipe_fprinted(out[ox],work.size);
+}
+
+static void
+pipe_probe(const s_pipe_read& work) {
+	Fileno_t out[2];
+	fprint_t key;
+	int rc = probe_fprint(global_files.pathname(work.file),work.size,pipe_probes(work.size),
+		probe_blksiz,key);
 
-	rc = dir.open(directory.c_str());
 	if ( rc ) {
-		fprintf(stderr,"%s: opening directory %s\n",
-			strerror(rc),
-			directory.c_str());
-		--dive_depth;
-		exit_code |= 2;
+		global_files.error(work.file) = rc;
 		return;
 	}
-	tracef(2,"Examining dir %s\n",directory.c_str());
+	key = xxh64(&key,sizeof key,global_files.fprint(work.file));
 
-	while ( (rc = dir.read(path,"*",Dir::Any)) == 0 ) {
-		rc = ::lstat(path.c_str(),&sbuf);
-		if ( rc != 0 ) {
-			if ( errno == ENOENT ) {
-				::lstat(path.c_str(),&sbuf);
-				if ( S_ISLNK(sbuf.st_mode) ) {
-					tracef(2,"Ignoring symlink %s\n",path.c_str());
-					continue;
-				}
-			}
+	const unsigned n = pipe_probed.add(work.size,key,work.file,out);
+
+	for ( unsigned ox=0; ox < n; ++ox )
+		pipe_final(out[ox],work.size,key);
+}
+
+static void
+pipe_hash(const s_pipe_read& work) {
+
+	hash_file(work.file);
+}
+
+static void
+pipe_worker(unsigned thx) {
+	s_pipe_read rd;
+	s_dirwork dwork;
+	uint64_t disk;
+
+	// Run an item of a read stage, if next (when given) has room
+	auto take = [&](DeviceScheduler<s_pipe_read>& queue,DeviceScheduler<s_pipe_read> *next,
+	  void (*func)(const s_pipe_read&)) -> bool {
+		if ( next && next->size() >= pipe_queue_max )
+			return false;
+		if ( !queue.try_pop(rd,disk) )
+			return false;
+		func(rd);
+		queue.done(disk);
+		pipeline.done();
+		return true;
+	};
+
+	for (;;) {
+		const uint64_t seen = pipeline.state();
 
-			fprintf(stderr,"%s: stat(2) on '%s'\n",strerror(errno),path.c_str());
+		if ( take(pipe_hashq,nullptr,pipe_hash)
+		  || take(pipe_probeq,&pipe_hashq,pipe_probe)
+		  || take(pipe_fprintq,&pipe_probeq,pipe_fprint) )
 			continue;
-		}
 
-		if ( S_ISREG(sbuf.st_mode) ) {
-			if ( opt_size == 0 || off_t(opt_size) <= sbuf.st_size ) {
-				fileno = global_files.add(path.c_str());
-				tracef(3,"%ld: file %s\n",long(fileno),path.c_str());
-			}
-		} else if ( S_ISDIR(sbuf.st_mode) ) {
-			++dive_depth;
-			dir_queue.push(path);
-		} else	{
-			tracef(2,"Ignoring %s\n",path.c_str());
+		if ( pipe_fprintq.size() < pipe_queue_max && dir_sched.try_pop(thx,dwork) ) {
+			dive_dir(dwork,thx);
+			dir_sched.done();
+			pipeline.done();
+			continue;
 		}
+
+		if ( !pipeline.wait(seen) )
+			break;
 	}
-	dir.close();
+}
 
-	if ( rc != ENOENT ) {
-		fprintf(stderr,"%s: Reading directory %s\n",strerror(rc),path.c_str());
-		exit_code |= 2;
+//////////////////////////////////////////////////////////////////////
+// Once the pipeline is drained, the files that reached its last
+// stage, less any that failed, sorted into runs for verify
+//////////////////////////////////////////////////////////////////////
+
+static void
+pipe_candidates(CandidateTable& table) {
+
+	table.reserve(pipe_finals.size());
+	for ( auto& rec : pipe_finals )
+		if ( global_files.error(rec.file) == 0 )
+			table.add(rec.size,rec.key,rec.file);
+	pipe_finals.clear();
+	pipe_finals.shrink_to_fit();
+
+	table.sort(true);
+	table.drop_singletons(true);
+
+	tracef(1,"Pipeline: %llu size, %llu fingerprint, %llu probe candidates, %llu hashed\n",
+		(unsigned long long)metrics.total(Metric::SizeCandidates),
+		(unsigned long long)metrics.total(Metric::FprintCandidates),
+		(unsigned long long)metrics.total(Metric::ProbeCandidates),
+		(unsigned long long)metrics.total(Metric::Hashes));
+}
+
+//////////////////////////////////////////////////////////////////////
+// External memory mode (--mem-limit)
+//
+// Scan records were spilled to ext_scan, which returns them sorted
+// by size and inode. Each size class holding more than one inode is
+// fingerprinted a batch at a time, and fed to a second sort by size
+// and fingerprint. Its groups are then verified a batch at a time,
+// so that only directory names stay resident.
+//////////////////////////////////////////////////////////////////////
+
+struct s_extgroup {
+	uint64_t		size;
+	std::vector<s_extrec>	recs;		// Hard links are adjacent
+	std::vector<size_t>	primaries;	// First record of each inode
+	std::vector<std::vector<unsigned>> classes; // Into primaries
+};
+
+static std::string
+ext_pathname(const s_extrec& rec) {
+	std::string path(dir_tree.pathname(rec.dir));
+
+	if ( path.size() > 1 )
+		path += '/';
+	path += ext_names.name(rec);
+	return path;
+}
+
+static void
+ext_emit(s_extgroup& group,const std::vector<std::string>& paths) {
+
+	for ( auto& eqclass : group.classes ) {
+		s_dupset set;
+
+		std::sort(eqclass.begin(),eqclass.end());
+		set.id = dup_pool.allocate();
+		set.size = group.size;
+		metrics.add(Metric::DupFiles,eqclass.size());
+		for ( auto px : eqclass ) {
+			size_t rx = group.primaries[px];
+
+			set.files.emplace_back();
+			set.files.back().path = paths[px];
+			for ( ++rx; rx < group.recs.size() && group.recs[rx].same_inode(group.recs[rx-1]); ++rx )
+				set.files.back().links.push_back(ext_pathname(group.recs[rx]));
+		}
+		emit(std::move(set));
 	}
-	--dive_depth;
 }
 
 static void
-dive() {
-	std::string dir;
+ext_verify(s_extgroup& group) {
+	std::vector<std::string> paths;
+	std::vector<int> errors;
+	off_t offset = 0;
+
+	for ( auto rx : group.primaries )
+		paths.push_back(ext_pathname(group.recs[rx]));
+
+	metrics.add(Metric::FprintCandidates,paths.size());
+	metrics.add(Metric::ProbeCandidates,paths.size());	// Not probed
+	if ( opt_exact ) {
+		group.classes = GlobalFiles::compare_paths(paths,offset,errors);
+		metrics.add(Metric::Compares);
+		ext_emit(group,paths);
+		return;
+	}
 
-	for (;;) {
-		if ( !dir_queue.pop(dir) ) {
-			if ( !dive_depth.load() )
-				break;
-			usleep(1000);
+	std::map<hash128_t,std::vector<unsigned>> by_hash;
+
+	for ( unsigned px=0; px < paths.size(); ++px ) {
+		hash128_t hash;
+
+		if ( !GlobalFiles::content_hash(paths[px],hash) ) {
+			fprintf(stderr,"%s: hashing %s\n",
+				strerror(errno ? errno : EIO),
+				paths[px].c_str());
+			continue;
+		}
+		metrics.add(Metric::Hashes);
+		by_hash[hash].push_back(px);
+	}
+
+	for ( auto& pair : by_hash ) {
+		auto& pxs = pair.second;
+
+		if ( pxs.size() < 2 )
+			continue;
+		if ( !opt_verify ) {
+			group.classes.push_back(std::move(pxs));
 			continue;
 		}
-		dive_dir(dir);
+
+		std::vector<std::string> subpaths;
+
+		for ( auto px : pxs )
+			subpaths.push_back(paths[px]);
+		offset = 0;
+		metrics.add(Metric::Compares);
+		for ( auto& eqclass : GlobalFiles::compare_paths(subpaths,offset,errors) ) {
+			group.classes.emplace_back();
+			for ( auto sx : eqclass )
+				group.classes.back().push_back(pxs[sx]);
+		}
+	}
+	ext_emit(group,paths);
+}
+
+static void
+ext_dedup() {
+	const size_t mem_bytes = size_t(opt_mem_limit) << 20;
+	const size_t batch_max = std::max(size_t(1024),mem_bytes / 8 / sizeof(s_extrec));
+	ExtSort by_fprint;
+	std::vector<s_extrec> batch;	// Of one size class
+	std::vector<s_extgroup> groups;
+	size_t nbatched = 0;
+	s_extrec rec;
+	bool more;
+	int rc;
+
+	auto fail = [](const char *what,int rc) {
+		fprintf(stderr,"%s: %s in %s\n",strerror(rc),what,opt_spill_dir);
+		exit(1);
+	};
+
+	if ( (rc = ext_names.flush()) != 0
+	  || (rc = ext_scan.error_code()) != 0
+	  || (rc = ext_scan.finish()) != 0 )
+		fail("spilling scan records",rc);
+
+	tracef(1,"External sort: %ld files, %ld spilled in %ld runs\n",
+		long(ext_scan.size()),long(ext_scan.spilled()),long(ext_scan.nruns()));
+
+	by_fprint.open(opt_spill_dir,1,mem_bytes / 2);
+
+	// Fingerprint each inode of the batch once, sharing it with links
+	auto fingerprint = [&]() {
+		std::vector<int> errors(batch.size(),0);
+		std::atomic<size_t> next(0);
+
+		parallel([&](unsigned thx) {
+			for ( size_t bx; (bx = next++) < batch.size(); ) {
+				s_extrec& r = batch[bx];
+
+				if ( bx > 0 && r.same_inode(batch[bx-1]) )
+					continue;
+				metrics.add(Metric::SizeCandidates);
+				errors[bx] = prefix_fprint(ext_pathname(r),r.size > 1024 ? 1024 : r.size,r.fprint);
+			}
+		});
+
+		for ( size_t bx=0; bx < batch.size(); ++bx ) {
+			if ( bx > 0 && batch[bx].same_inode(batch[bx-1]) ) {
+				batch[bx].fprint = batch[bx-1].fprint;
+				errors[bx] = errors[bx-1];
+			}
+			if ( errors[bx] == 0 )
+				by_fprint.add(0,batch[bx]);
+		}
+		batch.clear();
+	};
+
+	tracef(1,"Performing first 1k %s fingerprints..\n",hashkern->name);
+
+	more = ext_scan.next(rec);
+	while ( more ) {
+		const uint64_t size = rec.size;
+		size_t ninodes = 0;
+
+		batch.clear();
+		do	{
+			if ( batch.empty() || !rec.same_inode(batch.back()) ) {
+				// Batches end on an inode boundary
+				if ( ninodes >= 2 && batch.size() >= batch_max )
+					fingerprint();
+				++ninodes;
+			}
+			batch.push_back(rec);
+		} while ( (more = ext_scan.next(rec)) && rec.size == size );
+
+		if ( ninodes >= 2 )
+			fingerprint();
+	}
+
+	if ( (rc = ext_scan.error_code()) != 0
+	  || (rc = by_fprint.error_code()) != 0
+	  || (rc = by_fprint.finish()) != 0 )
+		fail("sorting fingerprints",rc);
+
+	tracef(1,"Fingerprint sort: %ld files, %ld spilled in %ld runs\n",
+		long(by_fprint.size()),long(by_fprint.spilled()),long(by_fprint.nruns()));
+
+	auto verify = [&]() {
+		std::atomic<size_t> next(0);
+
+		parallel([&](unsigned thx) {
+			for ( size_t gx; (gx = next++) < groups.size(); )
+				ext_verify(groups[gx]);
+		});
+		groups.clear();
+		nbatched = 0;
+	};
+
+	more = by_fprint.next(rec);
+	while ( more ) {
+		const uint64_t fprint = rec.fprint;
+		s_extgroup group;
+
+		group.size = rec.size;
+		do	{
+			if ( group.recs.empty() || !rec.same_inode(group.recs.back()) )
+				group.primaries.push_back(group.recs.size());
+			group.recs.push_back(rec);
+		} while ( (more = by_fprint.next(rec)) && rec.size == group.size && rec.fprint == fprint );
+
+		if ( group.primaries.size() < 2 )
+			continue;
+		nbatched += group.recs.size();
+		groups.push_back(std::move(group));
+		if ( nbatched >= batch_max )
+			verify();
 	}
+	verify();
+
+	if ( (rc = by_fprint.error_code()) != 0 )
+		fail("reading fingerprints",rc);
 }
 
 static void
@@ -125,7 +1694,31 @@ usage(const char *argv0) {
 		"\t-v, --verbose\n"
 		"\t--version\n"
 		"\t--threads n\tDefaults to 4\n"
-		"\t-s, --size n\tSize >= n bytes\n",
+		"\t-s, --size n\tSize >= n bytes\n"
+		"\t--max-size n\tSize <= n bytes\n"
+		"\t--verify\tByte compare hash matches (else the 128-bit\n"
+		"\t\t\tnon-cryptographic hash is trusted)\n"
+		"\t--exact\t\tByte compare candidates, no hashing\n"
+		"\t--hash name\tFirst 1k fingerprint (--hash list)\n"
+		"\t--cache path\tPersistent fingerprint cache file\n"
+		"\t--cache-keep n\tKeep unseen cache entries n runs (3)\n"
+		"\t--mem-limit n\tSpill to disk, using about n MB\n"
+		"\t--spill-dir path\tDirectory for spill files ($TMPDIR)\n"
+		"\t--format name\ttext, nul, jsonl or binary\n"
+		"\t--action name\tdedupe or hardlink each set\n"
+		"\t--io name\tpread, mmap or uring file reading\n"
+		"\t--chunk n\tRead n MiB at a time, 1-16 (1)\n"
+		"\t--pagecache name\tkeep, dontneed or direct\n"
+		"\t--dev-threads n\tReaders per rotational disk (1)\n"
+		"\t--probe list\tProbe stages: head, tail, n blocks, or none (head,tail,4)\n"
+		"\t--no-pipeline\tWalk, fingerprint and verify one after another\n"
+		"\t--exclude glob\tSkip matching names (or paths), before stat\n"
+		"\t--include glob\tWalk matching names, ahead of later --exclude\n"
+		"\t--max-depth n\tRead at most n directory levels below each root\n"
+		"\t--one-file-system\tDo not cross into other filesystems\n"
+		"\t--stats name\ttext or json run metrics, to stderr\n"
+		"\t--progress n\tProgress line to stderr every n seconds\n"
+		"\t--progress-socket path\tJSON progress to each connection\n",
 		argv0);
 	exit(0);
 }
@@ -140,10 +1733,34 @@ main(int argc,char **argv) {
 		{"threads",	required_argument,	nullptr,	2 },	// 2
 		{"help",	no_argument,		&opt_help,	'h' },	// 3
 		{"size",	required_argument,	nullptr,	4 },	// 4
+		{"verify",	no_argument,		nullptr,	5 },	// 5
+		{"exact",	no_argument,		nullptr,	6 },	// 6
+		{"hash",	required_argument,	nullptr,	7 },	// 7
+		{"cache",	required_argument,	nullptr,	8 },	// 8
+		{"cache-keep",	required_argument,	nullptr,	9 },	// 9
+		{"mem-limit",	required_argument,	nullptr,	10 },	// 10
+		{"spill-dir",	required_argument,	nullptr,	11 },	// 11
+		{"format",	required_argument,	nullptr,	12 },	// 12
+		{"action",	required_argument,	nullptr,	13 },	// 13
+		{"io",		required_argument,	nullptr,	14 },	// 14
+		{"chunk",	required_argument,	nullptr,	15 },	// 15
+		{"pagecache",	required_argument,	nullptr,	16 },	// 16
+		{"dev-threads",	required_argument,	nullptr,	17 },	// 17
+		{"stats",	required_argument,	nullptr,	18 },	// 18
+		{"progress",	required_argument,	nullptr,	19 },	// 19
+		{"progress-socket", required_argument,	nullptr,	20 },	// 20
+		{"probe",	required_argument,	nullptr,	21 },	// 21
+		{"no-pipeline",	no_argument,		nullptr,	22 },	// 22
+		{"exclude",	required_argument,	nullptr,	23 },	// 23
+		{"include",	required_argument,	nullptr,	24 },	// 24
+		{"max-depth",	required_argument,	nullptr,	25 },	// 25
+		{"one-file-system", no_argument,	nullptr,	26 },	// 26
+		{"max-size",	required_argument,	nullptr,	27 },	// 27
 		{0,         	0,             		nullptr,	0 },	// End
 	};
 	int option_index = 0;
 	int ch;
+	const auto t_start = std::chrono::steady_clock::now();
 	
 	for (;;) {
 		ch = getopt_long(argc,argv,"vVr:sh",long_options,&option_index);
@@ -168,6 +1785,114 @@ main(int argc,char **argv) {
 		case 4:
 			opt_size = strtoull(optarg,nullptr,10);
 			break;
+		case 5:			// --verify
+			opt_verify = 1;
+			break;
+		case 6:			// --exact
+			opt_exact = 1;
+			break;
+		case 7:			// --hash
+			if ( !strcmp(optarg,"list") ) {
+				printf("Fingerprint kernels:\n");
+				HashKernel::list(stdout);
+				exit(0);
+			}
+			hashkern = HashKernel::lookup(optarg);
+			if ( !hashkern ) {
+				fprintf(stderr,"Unknown or unsupported --hash %s\n",optarg);
+				exit(1);
+			}
+			break;
+		case 8:			// --cache
+			opt_cache = optarg;
+			break;
+		case 9:			// --cache-keep
+			opt_cache_keep = strtoul(optarg,nullptr,10);
+			break;
+		case 10:		// --mem-limit
+			opt_mem_limit = strtoull(optarg,nullptr,10);
+			break;
+		case 11:		// --spill-dir
+			opt_spill_dir = optarg;
+			break;
+		case 12:		// --format
+			if ( !DupWriter::parse(optarg,opt_format) ) {
+				fprintf(stderr,"Unknown --format %s\n",optarg);
+				exit(1);
+			}
+			break;
+		case 13:		// --action
+			if ( !DupAction::parse(optarg,opt_action) ) {
+				fprintf(stderr,"Unknown --action %s\n",optarg);
+				exit(1);
+			}
+			break;
+		case 14:		// --io
+			if ( !FileReader::parse(optarg,FileReader::engine) ) {
+				fprintf(stderr,"Unknown --io %s\n",optarg);
+				exit(1);
+			}
+			break;
+		case 15:		// --chunk
+			{
+				unsigned long mib = strtoul(optarg,nullptr,10);
+
+				if ( mib < 1 || mib > 16 ) {
+					fprintf(stderr,"--chunk must be 1 to 16 (MiB)\n");
+					exit(1);
+				}
+				FileReader::chunk = mib * 1024 * 1024;
+			}
+			break;
+		case 16:		// --pagecache
+			if ( !FileReader::parse(optarg,FileReader::pagecache) ) {
+				fprintf(stderr,"Unknown --pagecache %s\n",optarg);
+				exit(1);
+			}
+			opt_cache_sample = true;
+			break;
+		case 17:		// --dev-threads
+			opt_dev_threads = strtoul(optarg,nullptr,10);
+			if ( opt_dev_threads < 1 ) {
+				fprintf(stderr,"--dev-threads must be at least 1\n");
+				exit(1);
+			}
+			break;
+		case 18:		// --stats
+			if ( !Metrics::parse(optarg,opt_stats_json) ) {
+				fprintf(stderr,"Unknown --stats %s\n",optarg);
+				exit(1);
+			}
+			opt_stats = metrics.timing = true;
+			break;
+		case 19:		// --progress
+			opt_progress = strtoul(optarg,nullptr,10);
+			break;
+		case 20:		// --progress-socket
+			opt_progress_socket = optarg;
+			break;
+		case 21:		// --probe
+			if ( !parse_probes(optarg,opt_probes) ) {
+				fprintf(stderr,"Bad --probe %s (head, tail or 1-64, comma separated, or none)\n",optarg);
+				exit(1);
+			}
+			break;
+		case 22:		// --no-pipeline
+			opt_pipeline = false;
+			break;
+		case 23:		// --exclude
+		case 24:		// --include
+			opt_filter.add(optarg,ch == 24);
+			break;
+		case 25:		// --max-depth
+			opt_max_depth = strtoul(optarg,nullptr,10);
+			break;
+		case 26:		// --one-file-system
+			opt_one_fs = true;
+			break;
+		case 27:		// --max-size
+			opt_max_size = strtoull(optarg,nullptr,10);
+			break;
 		default:
 			printf("Unknown option: -%c\n",ch);
 			exit(1);
@@ -182,6 +1907,63 @@ main(int argc,char **argv) {
 	if ( opt_threads <= 0 )
 		opt_threads = 4;
 
+	if ( FileReader::engine == IoEngine::Uring ) {
+		int rc;
+
+		if ( FileReader::pagecache == PageCache::Dontneed ) {
+			fprintf(stderr,"--pagecache dontneed reads with pread, not io_uring\n");
+			FileReader::engine = IoEngine::Pread;
+		} else if ( !Uring::available(rc) ) {
+			fprintf(stderr,"%s: io_uring not available, reading with pread\n",strerror(rc));
+			FileReader::engine = IoEngine::Pread;
+		}
+	}
+
+	if ( !hashkern )
+		hashkern = HashKernel::best();
+
+	// Hard links replace files: never on the strength of a hash alone
+	if ( opt_action == Action::Hardlink && !opt_exact )
+		opt_verify = 1;
+	dup_action.set(opt_action);
+
+	// --mem-limit has stages of its own, io_uring batches each phase,
+	// and --pagecache samples the cache after the walk, before any read
+	if ( opt_mem_limit > 0 || FileReader::engine == IoEngine::Uring || opt_cache_sample )
+		opt_pipeline = false;
+	pipe_hashing = opt_pipeline && !opt_exact && !(opt_action == Action::Dedupe && !opt_verify);
+	metrics.start(t_start,opt_pipeline ? "pipeline" : "traverse");
+
+	if ( opt_mem_limit > 0 ) {
+		if ( opt_cache ) {
+			fprintf(stderr,"--cache cannot be used with --mem-limit\n");
+			exit(1);
+		}
+		if ( !opt_spill_dir ) {
+			opt_spill_dir = getenv("TMPDIR");
+			if ( !opt_spill_dir || !*opt_spill_dir )
+				opt_spill_dir = "/tmp";
+		}
+
+		int rc = ext_names.open(opt_spill_dir,opt_threads);
+
+		if ( rc ) {
+			fprintf(stderr,"%s: creating spill files in %s\n",strerror(rc),opt_spill_dir);
+			exit(1);
+		}
+		ext_scan.open(opt_spill_dir,opt_threads,(size_t(opt_mem_limit) << 20) / 2);
+	}
+
+	if ( opt_cache ) {
+		int rc = fpcache.open(opt_cache,hashkern->name);
+
+		if ( rc ) {
+			fprintf(stderr,"%s: opening cache %s\n",strerror(rc),opt_cache);
+			exit(1);
+		}
+		tracef(1,"Fingerprint cache %s: %ld entries\n",opt_cache,long(fpcache.size()));
+	}
+
 	if ( opt_help )
 		usage(argv[0]);
 
@@ -208,6 +1990,18 @@ main(int argc,char **argv) {
 
 	{
 		bool fail = false;
+		unsigned rx = 0;
+
+		struct rlimit rlim;
+
+		dir_sched.resize(opt_threads);
+
+		// Leave most descriptors for the file reading stages, and
+		// half for the compares of all threads
+		if ( getrlimit(RLIMIT_NOFILE,&rlim) == 0 && rlim.rlim_cur != RLIM_INFINITY ) {
+			dirfd_budget.store(long(rlim.rlim_cur / 4));
+			GlobalFiles::compare_fds = std::max(rlim_t(4),rlim.rlim_cur / 2 / opt_threads);
+		} else	dirfd_budget.store(256);
 
 		// Check that these are directories (or symlinks to one)
 		for ( auto& dir : opt_rootvec ) {
@@ -220,271 +2014,144 @@ main(int argc,char **argv) {
 				fprintf(stderr,"Not a directory: %s\n",dir.c_str());
 				fail = true;
 			}
-			dir_queue.push(dir);
+			s_dirwork work;
+
+			work.path = dir;
+			work.node = dir_tree.intern(dir.c_str());
+			work.rootlen = dir.size();
+			work.dev = sbuf.st_dev;
+			push_dir(rx++,work);
 		}
 		if ( fail )
 			exit(1);
 	}
 
-	dive_depth.store(dir_queue.size());
+	if ( opt_progress > 0 || opt_progress_socket ) {
+		int rc = progress.start(opt_progress,opt_progress_socket);
+
+		if ( rc ) {
+			fprintf(stderr,"%s: progress socket %s\n",strerror(rc),opt_progress_socket);
+			exit(1);
+		}
+	}
 
 	//////////////////////////////////////////////////////////////
 	// Start worker threads
 	//////////////////////////////////////////////////////////////
 
 	for ( int thx=0; thx<opt_threads; ++thx ) {
-		thvec.emplace_back(std::thread(dive));
+		thvec.emplace_back(std::thread(opt_pipeline ? pipe_worker : dive,unsigned(thx)));
 	}
 
 	for ( auto& thread : thvec )
 		thread.join();
 	thvec.clear();
+	if ( opt_pipeline )
+		phase_done("pipeline","group");
+	else	phase_done("traverse",opt_mem_limit > 0 ? "external" : "fingerprint");
+
+	dup_writer.start(stdout,opt_format,t_start);
+
+	if ( opt_mem_limit > 0 ) {
+		ext_dedup();
+		dup_writer.finish();
+		phase_done("external");
+		tracef(1,"%ld duplicate sets, first after %.3f s\n",
+			long(dup_writer.sets()),dup_writer.first_result());
+		if ( opt_action != Action::None )
+			dup_action.report(stderr);
+		progress.stop();
+		if ( opt_stats )
+			metrics.report(stderr,opt_stats_json,opt_threads,dup_writer.first_result());
+		tracef(1,"Exit.\n");
+		return exit_code;
+	}
 
-	tracef(2,"%ld files registered, + %ld name ids\n",
-		long(global_files.size()),
-		long(name_pool.size()));
+	global_files.freeze();		// Lookups are lock free from here on
 
-	auto candidates = global_files.dup_candidates();
-	std::map<size_t,std::unordered_map<crc32_t,std::set<Fileno_t>>> candidates2;
+	tracef(2,"%ld files registered, + %ld name ids, %ld directories\n",
+		long(global_files.size()),
+		long(name_pool.size()),
+		long(dir_tree.size()));
+	tracef(1,"File table: %ld files, %u bytes per file\n",
+		long(global_files.size()),
+		unsigned(GlobalFiles::bytes_per_file()));
 
 	{
-		std::unordered_map<crc32_t,std::unordered_set<Fileno_t>> candidates_crc32;
-		struct s_size_qent {
-			Fileno_t	fileno;
-			size_t		size;
-			
-		};
-		struct s_crc32 : public s_size_qent {
-			crc32_t		crc32;
-		};
-		Queue<s_size_qent>	inq;
-
-		auto crc32 = [](Fileno_t fileno,size_t size,bool& ok) -> crc32_t {
-			s_file_ent& fent = global_files.lookup(fileno);
-			const std::string path(global_files.pathname(fileno));
-			char buf[size];
-			int fd = ::open(path.c_str(),O_RDONLY);
-			int rc;
-
-			if ( fd == -1 ) {
-				fent.error = errno;
-				fprintf(stderr,"%s: opening %s for CRC32\n",strerror(errno),path.c_str());
-				fent.crc32 = 0;
-				ok = false;
-				return 0;
-			}
-			do	{
-				rc = ::read(fd,buf,sizeof buf);
-			} while ( rc == -1 && errno == EINTR );
-
-			if ( rc != int(sizeof buf) ) {
-				ok = false;
-				fent.error = errno;
-				::close(fd);
-				return 0;
-			}
-			::close(fd);
-
-			uint32_t crc = 0;
-
-			global_files.crc32(crc,buf,sizeof buf);
-			fent.crc32 = crc;
-			fent.error = 0;
-			ok = true;
-			return crc;
-		};
-
-		// Queue up CRC32 work:
-		for ( auto& pair : candidates ) {
-			s_size_qent qent;
-			qent.size = pair.first;
-			const auto& fileset = pair.second;
-			crc32_t crc;
-			bool ok;
-
-			for ( auto fileno: fileset ) {
-				qent.fileno = fileno;
-				inq.push(qent);
-			}
-		}		
-
-		auto crc32_func = [&]() {
-			s_size_qent qent;
-			bool ok;
-
-			while ( inq.pop(qent) ) {
-				crc32(qent.fileno,qent.size>1024?1024:qent.size,ok);
-			}
-		};
-
-		tracef(1,"Performing first 1k CRC32 calcs on %ld files..\n",long(inq.size()));
-
-		std::vector<std::thread> tvec;
-		for ( int thx=0; thx < opt_threads; ++thx )
-			tvec.emplace_back(std::thread(crc32_func));
-
-		for ( auto& thread : tvec )
-			thread.join();
-		tvec.clear();
-
-		for ( auto& pair : candidates ) {
-			const off_t size = pair.first;
-			const auto& fileset = pair.second;
-			crc32_t crc;
-			bool ok;
-
-			for ( auto fileno: fileset ) {
-				s_file_ent& fent = global_files.lookup(fileno);
-
-				if ( fent.error != 0 )
-					continue;
-
-				candidates2[size][fent.crc32].insert(fileno);
-				std::string path(global_files.namestr_pathname(fent.path));
-				tracef(2,"File crc32 %08X size %9ld file %ld %s\n",
-					unsigned(fent.crc32),long(size),long(fileno),path.c_str());
-			}
-		}
-		candidates.clear();
+		const uint64_t nopen = metrics.total(Metric::OpenCalls);
+		const uint64_t ngetdents = metrics.total(Metric::GetdentsCalls);
+		const uint64_t nstat = metrics.total(Metric::StatCalls);
+		const uint64_t nclose = metrics.total(Metric::CloseCalls);
+		const uint64_t nsys = nopen + ngetdents + nstat + nclose;
+		const size_t nfiles = global_files.size();
+
+		tracef(1,"Traversal: %llu syscalls (open %llu, getdents %llu, stat %llu, close %llu), %.2f per file\n",
+			(unsigned long long)nsys,
+			(unsigned long long)nopen,
+			(unsigned long long)ngetdents,
+			(unsigned long long)nstat,
+			(unsigned long long)nclose,
+			nfiles ? double(nsys) / nfiles : 0.0);
 	}
 
-	unsigned cancount = 0;
+	if ( opt_cache_sample ) {
+		// Residency of a spread of the files, to see what the run evicts
+		const size_t stride = global_files.size() / max_cache_sample + 1;
+		size_t fx = 0;
 
-	for ( auto& pair : candidates2 ) {
-		const size_t size = pair.first;
-		auto& crc32map = pair.second;
-
-		for ( auto& pair2 : crc32map ) {
-			const crc32_t crc = pair2.first;
-			auto& fileset = pair2.second;
-				
-			if ( fileset.size() >= 2 )
-				cancount += fileset.size();
-		}
+		global_files.for_each([&](Fileno_t fileno) {
+			if ( fx++ % stride == 0 )
+				cache_sample.add(global_files.pathname(fileno));
+		});
+		cache_sample.start();
 	}
 
-	tracef(2,"CRC32 Dup Candidates: %u\n",cancount);
-
-	std::map<size_t,std::unordered_map<crc32_t,std::set<Fileno_t>>> final_candidates;
-
-	for ( auto& pair : candidates2 ) {
-		const size_t size = pair.first;
-		auto& crc32map = pair.second;
-
-		for ( auto& pair2 : crc32map ) {
-			const crc32_t crc32 = pair2.first;
-			auto& fileset = pair2.second;
-				
-			if ( fileset.size() <= 1 )
-				continue;
-
-			for ( auto file : fileset ) {
-				s_file_ent& fent = global_files.lookup(file);
-				std::string path(global_files.namestr_pathname(fent.path));
-					
-				final_candidates[size][crc32].insert(file);
-			}
-		}
+	CandidateTable table(opt_threads);
+
+	if ( opt_pipeline ) {
+		pipe_candidates(table);
+		phase_done("group","verify");
+	} else if ( !opt_probes.empty() ) {
+		fingerprint_candidates(table);
+		phase_done("group","probe");
+		probe_candidates(table);
+		phase_done("probe","verify");
+	} else	{
+		fingerprint_candidates(table);
+		metrics.add(Metric::ProbeCandidates,table.size());
+		phase_done("group","verify");
 	}
 
-	std::map<size_t,std::map<dup_t,std::set<Fileno_t>>> dups;
-
 	tracef(2,"Final file comparisons:\n");
 
-	for ( auto& pair : final_candidates ) {
-		const size_t size = pair.first;
-		auto& crc32map = pair.second;
-		bool sizef = false;
-
-		for ( auto& pair2 : crc32map ) {
-			const crc32_t crc32 = pair2.first;
-			auto& fileset = pair2.second;
-			bool crcf = false;
-				
-			for ( auto file1 : fileset ) {
-				s_file_ent& fent1 = global_files.lookup(file1);
-				std::string path1(global_files.namestr_pathname(fent1.path));
-				const char *match = "?";
-
-				if ( !sizef ) {
-					tracef(2,"SIZE: %ld bytes\n",long(size));
-					sizef = true;
-				}
-				if ( !crcf ) {
-					tracef(2,"  CRC32 %08X:\n",unsigned(crc32));
-					crcf = true;
-				}
-
-				for ( auto file2 : fileset ) {
-					if ( file2 == file1 )
-						continue;
-
-					s_file_ent& fent2 = global_files.lookup(file2);
-					std::string path2(global_files.namestr_pathname(fent2.path));
-
-					if ( fent1.duplicate != 0 && fent2.duplicate != 0 )
-						continue;	// Already evaluated
-
-					auto cmpf = global_files.compare_equal(file1,file2);
-
-					switch ( cmpf ) {
-					case Compare::Equal:
-						match = "Equal";
-						break;
-					case Compare::NotEqual:
-						match = "Not Equal";
-						break;
-					case Compare::Error:
-						match = "ERROR";
-						break;
-					}
-
-					if ( cmpf == Compare::Equal ) {
-						if ( !fent1.duplicate && !fent2.duplicate ) {
-							fent1.duplicate = fent2.duplicate = dup_pool.allocate();
-							dups[size][fent1.duplicate].insert(file1);
-							dups[size][fent2.duplicate].insert(file2);
-						} else if ( !fent1.duplicate ) {
-							fent1.duplicate = fent2.duplicate;
-							dups[size][fent1.duplicate].insert(file1);
-						} else	{
-							// !fent2.duplicate
-							fent2.duplicate = fent1.duplicate;
-							dups[size][fent2.duplicate].insert(file2);
-						}
-					}
-
-					tracef(2,"    %s (%ld) vs %s (%ld) : %s\n",
-						path1.c_str(),long(fent1.fileno),
-						path2.c_str(),long(fent2.fileno),
-						match);
-				}
-			}
-		}
-	}
-
-	printf("LIST OF DUPLICATE FILES:\n");
-
-	for ( auto pair : dups ) {
-		const size_t size = pair.first;
-		auto& dupmap = pair.second;
-
-		for ( auto pair2 : dupmap ) {
-			const dup_t dup_id = pair2.first;
-			const auto& fileset = pair2.second;
-
-			printf("  Duplicate set %ld, %ld bytes:\n",long(dup_id),long(size));
-			for ( auto fileno : fileset ) {
-				auto& fent = global_files.lookup(fileno);
-				const std::string path(global_files.namestr_pathname(fent.path));
-
-				printf("    File %s\n",path.c_str());
-				for ( auto& nstr : fent.links ) {
-					const std::string lpath(global_files.namestr_pathname(nstr));
-
-					printf("      ln %s\n",lpath.c_str());
-				}
-			}
+	verify_candidates(table);
+	dup_writer.finish();
+	phase_done("verify");
+	progress.stop();
+	tracef(1,"%ld duplicate sets, first after %.3f s\n",
+		long(dup_writer.sets()),dup_writer.first_result());
+	if ( uring_submits.load() > 0 )
+		tracef(1,"io_uring: %llu SQEs in %llu submits, %.1f MB read\n",
+			(unsigned long long)uring_sqes.load(),
+			(unsigned long long)uring_submits.load(),
+			uring_bytes.load() / 1048576.0);
+	if ( opt_action != Action::None )
+		dup_action.report(stderr);
+	if ( opt_cache_sample )
+		cache_sample.report(stderr);
+	if ( opt_stats )
+		metrics.report(stderr,opt_stats_json,opt_threads,dup_writer.first_result());
+
+	if ( fpcache.is_open() ) {
+		tracef(1,"Cache: fingerprint %ld hits %ld misses, hash %ld hits %ld misses\n",
+			long(fpcache.fprint_hits.load()),long(fpcache.fprint_misses.load()),
+			long(fpcache.hash_hits.load()),long(fpcache.hash_misses.load()));
+
+		int rc = fpcache.save(global_files,opt_cache_keep);
+
+		if ( rc ) {
+			fprintf(stderr,"%s: saving cache %s\n",strerror(rc),opt_cache);
+			exit_code |= 4;
 		}
 	}
 
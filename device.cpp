@@ -0,0 +1,102 @@
+//////////////////////////////////////////////////////////////////////
+// device.cpp -- Block devices under the scanned files
+// Date: Sun Oct 18 18:09:40 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#endif
+
+#include "device.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Read the first line of a small sysfs file
+//////////////////////////////////////////////////////////////////////
+
+static bool
+read_sysfs(const std::string& path,std::string& value) {
+	char buf[64];
+	FILE *f = fopen(path.c_str(),"r");
+
+	if ( !f )
+		return false;
+
+	bool ok = fgets(buf,sizeof buf,f) != nullptr;
+
+	fclose(f);
+	if ( ok )
+		value.assign(buf,strcspn(buf,"\n"));
+	return ok;
+}
+
+s_devinfo
+Devices::lookup(dev_t dev) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = devs.find(dev);
+
+	if ( it != devs.end() )
+		return it->second;
+
+	s_devinfo info = { uint64_t(dev), false };
+
+	if ( major(dev) != 0 ) {
+		std::string sys = "/sys/dev/block/" + std::to_string(major(dev))
+			+ ":" + std::to_string(minor(dev)), value;
+		unsigned maj, min;
+
+		if ( access((sys + "/partition").c_str(),F_OK) == 0 ) {
+			sys += "/..";		// The disk holding the partition
+			if ( read_sysfs(sys + "/dev",value) && sscanf(value.c_str(),"%u:%u",&maj,&min) == 2 )
+				info.disk = makedev(maj,min);
+		}
+		if ( read_sysfs(sys + "/queue/rotational",value) )
+			info.rotational = value == "1";
+	}
+
+	devs[dev] = info;
+	devs.emplace(info.disk,info);
+	return info;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Physical offset of the start of a file on its disk, by FIEMAP.
+// Returns false where the filesystem does not say (or the file has
+// no extents).
+//////////////////////////////////////////////////////////////////////
+
+bool
+Devices::physical(const std::string& path,uint64_t& offset) {
+#ifdef FS_IOC_FIEMAP
+	uint64_t mem[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / 8 + 1] = { 0 };
+	struct fiemap *map = (struct fiemap *)mem;
+	int fd = ::open(path.c_str(),O_RDONLY|O_CLOEXEC);
+
+	if ( fd == -1 )
+		return false;
+
+	map->fm_start = 0;
+	map->fm_length = FIEMAP_MAX_OFFSET;
+	map->fm_extent_count = 1;
+
+	int rc = ::ioctl(fd,FS_IOC_FIEMAP,map);
+
+	::close(fd);
+	if ( rc == -1 || map->fm_mapped_extents == 0 )
+		return false;
+	offset = map->fm_extents[0].fe_physical;
+	return true;
+#else
+	return false;
+#endif
+}
+
+// End device.cpp
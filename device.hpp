@@ -0,0 +1,39 @@
+//////////////////////////////////////////////////////////////////////
+// device.hpp -- Block devices under the scanned files
+// Date: Sun Oct 18 18:02:14 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef DEVICE_HPP
+#define DEVICE_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <mutex>
+#include <unordered_map>
+
+struct s_devinfo {
+	uint64_t	disk;		// Whole disk holding the filesystem
+	bool		rotational;	// Seeks are costly
+};
+
+//////////////////////////////////////////////////////////////////////
+// Maps the st_dev of a filesystem to the disk it lives on, from
+// /sys/dev/block, so that partitions of one disk share a queue.
+// Filesystems with no block device (tmpfs, NFS..) are their own
+// disk, and taken to be non-rotational.
+//////////////////////////////////////////////////////////////////////
+
+class Devices {
+	std::mutex				mutex;
+	std::unordered_map<uint64_t,s_devinfo>	devs;
+
+public:	s_devinfo lookup(dev_t dev);
+	size_t size() const { return devs.size(); }
+	static bool physical(const std::string& path,uint64_t& offset);
+};
+
+#endif // DEVICE_HPP
+
+// End device.hpp
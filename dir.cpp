@@ -5,105 +5,217 @@
 
 #include <string.h>
 #include <assert.h>
-#include <fnmatch.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <errno.h>
 
-#include "dir.hpp"
-
-#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
 
-#ifndef NAME_MAX
-# ifdef _DARWIN_FEATURE_64_BIT_INODE
-#  define NAME_MAX	1023
-# else
-#  define NAME_MAX	255
-# endif
+#include "dir.hpp"
+#include "metrics.hpp"
+
+#ifdef __linux__
+static const size_t dents_bufsiz = 64 * 1024;
+
+struct linux_dirent64 {
+	ino64_t		d_ino;
+	off64_t		d_off;
+	unsigned short	d_reclen;
+	unsigned char	d_type;
+	char		d_name[];
+};
 #endif
 
 Dir::Dir() {
-        dir = 0;
-        result = 0;
+	dirfd = -1;
+	error = 0;
+#ifdef __linux__
+	buf = nullptr;
+	buflen = bufpos = 0;
+#else
+	dir = 0;
+#endif
 }
 
 Dir::~Dir() {
-        if ( dir  )
-                close();
+	close();
+#ifdef __linux__
+	delete[] buf;
+#endif
 }
 
 int
 Dir::open(const char *pathname) {
-        dirname = pathname;
-        close();
-        dir = opendir(pathname);
-        return dir ? 0 : errno;
+	int fd = ::open(pathname,O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+
+	metrics.add(Metric::OpenCalls);
+
+	if ( fd == -1 )
+		return errno;
+	return open(fd,pathname);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Take ownership of an open directory descriptor
+//////////////////////////////////////////////////////////////////////
+
+int
+Dir::open(int fd,const char *pathname) {
+	close();
+	dirname = pathname;
+	dirfd = fd;
+	error = 0;
+#ifdef __linux__
+	if ( !buf )
+		buf = new char[dents_bufsiz];
+	buflen = bufpos = 0;
+#else
+	dir = fdopendir(fd);
+	if ( !dir ) {
+		error = errno;
+		::close(fd);
+		dirfd = -1;
+		return error;
+	}
+#endif
+	return 0;
 }
 
 void
 Dir::close() {
-        if ( dir ) {
-                closedir(dir);
-                dir = 0;
-        }
-        result = 0;
+#ifdef __linux__
+	if ( dirfd >= 0 ) {
+		::close(dirfd);
+		metrics.add(Metric::CloseCalls);
+	}
+	buflen = bufpos = 0;
+#else
+	if ( dir ) {
+		closedir(dir);		// Closes dirfd
+		metrics.add(Metric::CloseCalls);
+		dir = 0;
+	}
+#endif
+	dirfd = -1;
 }
 
-int
-Dir::read(std::string& name) {
-	int rc;
-	
-	name.clear();
-	if ( !dir )
-		return EBADF;          	// Not open
-	
-	rc = readdir_r(dir,&dentry,&result);
-	
-	if ( !rc && !result )
-		rc = ENOENT;            // No more entries
-	
-	if ( !rc ) {
-		char dname[NAME_MAX+1];
-		size_t slen = strlen(dentry.d_name);
-
-		if ( slen > NAME_MAX )
-			slen = NAME_MAX;
-		memcpy(dname,dentry.d_name,slen);
-		dname[slen] = 0;
-		name = dname;
+//////////////////////////////////////////////////////////////////////
+// Return the next entry name, other than "." and "..", or nullptr
+// at the end of the directory (or on error: see read()). The name
+// is valid until the next call. d_type is DT_UNKNOWN when the file
+// system does not supply it.
+//////////////////////////////////////////////////////////////////////
+
+const char *
+Dir::next(unsigned char& d_type) {
+
+	if ( dirfd < 0 ) {
+		error = EBADF;
+		return nullptr;
+	}
+
+	for (;;) {
+#ifdef __linux__
+		if ( bufpos >= buflen ) {
+			long rc;
+
+			do	{
+				rc = syscall(SYS_getdents64,dirfd,buf,dents_bufsiz);
+				metrics.add(Metric::GetdentsCalls);
+			} while ( rc == -1 && errno == EINTR );
+			if ( rc <= 0 ) {
+				error = rc == 0 ? 0 : errno;
+				return nullptr;
+			}
+			buflen = rc;
+			bufpos = 0;
+		}
+
+		const linux_dirent64 *dp = (const linux_dirent64 *)(buf + bufpos);
+
+		bufpos += dp->d_reclen;
+		d_type = dp->d_type;
+		const char *name = dp->d_name;
+#else
+		errno = 0;
+
+		const dirent *dp = readdir(dir);
+
+		metrics.add(Metric::GetdentsCalls);
+
+		if ( !dp ) {
+			error = errno;
+			return nullptr;
+		}
+		d_type = dp->d_type;
+		const char *name = dp->d_name;
+#endif
+		if ( name[0] == '.' && ( !name[1] || ( name[1] == '.' && !name[2] ) ) )
+			continue;
+		return name;
 	}
-	
-	return rc;
 }
 
+//////////////////////////////////////////////////////////////////////
+// Open a subdirectory relative to an open parent, without following
+// a symlink. Returns the descriptor, or -1 with errno set.
+//////////////////////////////////////////////////////////////////////
+
 int
-Dir::read(std::string& name,const char *wildpattern,FileType ftype) {
-        std::string objname;
-        int rc;
-
-        name.clear();
-        do      {
-                rc = read(objname);
-                if ( !rc ) {
-                        if ( fnmatch(wildpattern,objname.c_str(),FNM_PERIOD) != 0 )
-                                continue;
-
-                        name = dirname;
-                        name += "/";
-                        name += objname;
-                        if ( ftype == Any )
-                                break;
-                        else if ( ftype == Directory && dentry.d_type == DT_DIR ) {
-                                if ( objname != "." && objname != ".." )
-                                        break;
-                        } else if ( ftype == File && dentry.d_type == DT_REG )
-                                break;
-                        else if ( ftype == Symlink && dentry.d_type == DT_LNK )
-                                break;
-                }
-        } while ( !rc );
-
-        return rc;
+Dir::open_subdir(int dirfd,const char *name) {
+	int fd;
+
+	do	{
+		fd = ::openat(dirfd,name,O_RDONLY|O_DIRECTORY|O_NOFOLLOW|O_CLOEXEC);
+		metrics.add(Metric::OpenCalls);
+	} while ( fd == -1 && errno == EINTR );
+	return fd;
+}
+
+//////////////////////////////////////////////////////////////////////
+// lstat() an entry of an open directory. Where statx(2) exists, only
+// the fields deduper uses are requested. The other fields of sbuf are
+// zero. Attributes cached by NFS are revalidated as usual, since the
+// fingerprint cache trusts size and mtime. An automount point is not
+// mounted by the stat, and so reports a device other than its
+// parent's. Returns 0, or -1 with errno set.
+//////////////////////////////////////////////////////////////////////
+
+int
+Dir::stat_at(int dirfd,const char *name,struct stat& sbuf) {
+#ifdef STATX_TYPE
+	static std::atomic<bool> no_statx(false);
+
+	if ( !no_statx.load(std::memory_order_relaxed) ) {
+		const unsigned mask = STATX_TYPE|STATX_MODE|STATX_INO|STATX_NLINK|STATX_SIZE|STATX_MTIME;
+		struct statx stx;
+		int rc;
+
+		rc = statx(dirfd,name,AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT,mask,&stx);
+		metrics.add(Metric::StatCalls);
+		if ( rc == 0 ) {
+			memset(&sbuf,0,sizeof sbuf);
+			sbuf.st_dev = makedev(stx.stx_dev_major,stx.stx_dev_minor);
+			sbuf.st_ino = stx.stx_ino;
+			sbuf.st_mode = stx.stx_mode;
+			sbuf.st_nlink = stx.stx_nlink;
+			sbuf.st_size = stx.stx_size;
+			sbuf.st_mtim.tv_sec = stx.stx_mtime.tv_sec;
+			sbuf.st_mtim.tv_nsec = stx.stx_mtime.tv_nsec;
+			return 0;
+		}
+		if ( errno != ENOSYS )
+			return -1;
+		no_statx.store(true);	// Old kernel: use fstatat from now on
+	}
+#endif
+	metrics.add(Metric::StatCalls);
+	return ::fstatat(dirfd,name,&sbuf,AT_SYMLINK_NOFOLLOW|AT_NO_AUTOMOUNT);
 }
 
 std::string
@@ -7,35 +7,49 @@
 #define DIRENT_HPP
 
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <dirent.h>
 
 #include <string>
 
+//////////////////////////////////////////////////////////////////////
+// On Linux, entries are read with getdents64(2) into a large buffer
+// and returned in place. Elsewhere fdopendir(3)/readdir(3) is used.
+// Either way the directory is held open by a file descriptor, so
+// that entries can be examined with fstatat(fd(),name,...) and
+// subdirectories opened with open_subdir(fd(),name) rather than
+// looking up their full pathnames again.
+//////////////////////////////////////////////////////////////////////
+
 class Dir {
-public: enum FileType {
-		Any = 300,              // Any file type
-		Directory,              // Directory entries only
-		File,                   // File entries only
-		Symlink                 // Symlinks only
-	};
 protected:
 	std::string     dirname;        // Opened directory
+	int		dirfd;		// Open directory
+#ifdef __linux__
+	char		*buf;		// getdents64 buffer
+	size_t		buflen;		// Bytes in buf
+	size_t		bufpos;		// Next entry in buf
+#else
 	DIR             *dir;           // Opened directory
-	dirent          *result;        // Ref to last returned dir entry
-	dirent          dentry;         // Current directory entry
-	
-	int read(std::string& name);
+#endif
+	int		error;		// Last read error, else 0
 
 public: Dir();
 	~Dir();
 	
 	int open(const char *pathname);
+	int open(int fd,const char *pathname);
 	void close();
 	
-	inline bool is_open() { return dir != 0; }
+	inline bool is_open() { return dirfd >= 0; }
+	inline int fd() { return dirfd; }
+	inline const std::string& name() { return dirname; }
+	inline int error_code() { return error; }
 	
-	int read(std::string& name,const char *wildpattern,FileType ftype);
+	const char *next(unsigned char& d_type);
 
+	static int open_subdir(int dirfd,const char *name);
+	static int stat_at(int dirfd,const char *name,struct stat& sbuf);
 	static std::string basename(const std::string& path);
 	static std::string basename(const char *path);
 };
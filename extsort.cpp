@@ -0,0 +1,455 @@
+//////////////////////////////////////////////////////////////////////
+// extsort.cpp -- External merge sort of file records
+// Date: Sun Oct 18 09:58:02 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "extsort.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Write all of buf, returning 0 or errno
+//////////////////////////////////////////////////////////////////////
+
+static int
+write_all(int fd,const void *buf,size_t bytes) {
+	const char *cp = (const char *)buf;
+
+	while ( bytes > 0 ) {
+		ssize_t rc = ::write(fd,cp,bytes);
+
+		if ( rc == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			return errno;
+		}
+		cp += rc;
+		bytes -= rc;
+	}
+	return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Create an unlinked temporary file in dir, so that nothing is left
+// behind however the program ends.
+//////////////////////////////////////////////////////////////////////
+
+static int
+make_temp(const std::string& dir) {
+	std::string path(dir);
+
+	path += "/deduper.XXXXXX";
+
+	char tmpl[path.size()+1];
+
+	strcpy(tmpl,path.c_str());
+
+	int fd = mkstemp(tmpl);
+
+	if ( fd >= 0 )
+		::unlink(tmpl);
+	return fd;
+}
+
+NameLog::~NameLog() {
+	for ( auto& log : logs )
+		if ( log.fd >= 0 )
+			::close(log.fd);
+}
+
+int
+NameLog::open(const char *dir,unsigned nwriters) {
+
+	logs.resize(nwriters);
+	for ( auto& log : logs ) {
+		log.fd = make_temp(dir);
+		if ( log.fd < 0 )
+			return errno;
+		log.buf.reserve(bufsiz);
+	}
+	return 0;
+}
+
+int
+NameLog::write(s_log& log) {
+	int rc = write_all(log.fd,log.buf.data(),log.buf.size());
+
+	log.buf.clear();
+	if ( rc ) {
+		int expected = 0;
+
+		err.compare_exchange_strong(expected,rc);
+	}
+	return rc;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Log a name for writer thx, filling in the name fields of rec
+//////////////////////////////////////////////////////////////////////
+
+bool
+NameLog::append(unsigned thx,const char *name,s_extrec& rec) {
+	s_log& log = logs[thx];
+	const size_t len = strlen(name);
+
+	rec.log = thx;
+	rec.name_off = log.offset;
+	rec.name_len = len;
+	log.buf.append(name,len);
+	log.offset += len;
+
+	if ( log.buf.size() >= bufsiz )
+		return write(log) == 0;
+	return err.load() == 0;
+}
+
+int
+NameLog::flush() {
+
+	for ( auto& log : logs )
+		if ( !log.buf.empty() )
+			write(log);
+	return err.load();
+}
+
+std::string
+NameLog::name(const s_extrec& rec) {
+	char buf[rec.name_len];
+	size_t got = 0;
+
+	while ( got < rec.name_len ) {
+		ssize_t rc = ::pread(logs[rec.log].fd,buf+got,rec.name_len-got,rec.name_off+got);
+
+		if ( rc <= 0 ) {
+			if ( rc == -1 && errno == EINTR )
+				continue;
+			return std::string();
+		}
+		got += rc;
+	}
+	return std::string(buf,got);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Refill a merge cursor from its run. Returns false at the end.
+//////////////////////////////////////////////////////////////////////
+
+bool
+ExtSort::s_cursor::fill() {
+	size_t n = std::min(uint64_t(buf.size()),left);
+	size_t bytes = n * sizeof(s_extrec);
+	char *cp = (char *)buf.data();
+
+	bx = bn = 0;
+	if ( n == 0 )
+		return false;
+
+	while ( bytes > 0 ) {
+		ssize_t rc = ::pread(fd,cp,bytes,offset);
+
+		if ( rc <= 0 ) {
+			if ( rc == -1 && errno == EINTR )
+				continue;
+			return false;
+		}
+		cp += rc;
+		bytes -= rc;
+		offset += rc;
+	}
+	bn = n;
+	left -= n;
+	return true;
+}
+
+ExtSort::~ExtSort() {
+	for ( auto& run : runs )
+		if ( run.fd >= 0 )
+			::close(run.fd);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Half of mem_bytes is shared by the writer buffers, and half by
+// the merge cursors.
+//////////////////////////////////////////////////////////////////////
+
+void
+ExtSort::open(const char *dir,unsigned nwriters,size_t mem_bytes) {
+
+	this->dir = dir;
+	this->mem_bytes = mem_bytes;
+	max_recs = std::max(size_t(1024),mem_bytes / 2 / nwriters / sizeof(s_extrec));
+	buffers.resize(nwriters);
+}
+
+int
+ExtSort::temp_file() {
+	return make_temp(dir);
+}
+
+int
+ExtSort::write_run(std::vector<s_extrec>& recs) {
+	int fd = temp_file();
+	int rc;
+
+	if ( fd < 0 )
+		return errno;
+
+	std::sort(recs.begin(),recs.end());
+	rc = write_all(fd,recs.data(),recs.size() * sizeof(s_extrec));
+	if ( rc ) {
+		::close(fd);
+		return rc;
+	}
+
+	std::lock_guard<std::mutex> lock(runs_mutex);
+
+	runs.push_back({fd,uint64_t(recs.size())});
+	nrecs += recs.size();
+	nspilled += recs.size();
+	recs.clear();
+	return 0;
+}
+
+bool
+ExtSort::add(unsigned thx,const s_extrec& rec) {
+	auto& recs = buffers[thx];
+
+	recs.push_back(rec);
+	if ( recs.size() >= max_recs ) {
+		int rc = write_run(recs);
+
+		if ( rc ) {
+			int expected = 0;
+
+			err.compare_exchange_strong(expected,rc);
+			recs.clear();
+			return false;
+		}
+	}
+	return true;
+}
+
+int
+ExtSort::open_cursors(size_t first,size_t count) {
+	const size_t per = std::max(size_t(256),mem_bytes / 2 / sizeof(s_extrec) / count);
+
+	cursors.clear();
+	heap.clear();
+	cursors.resize(count);
+
+	for ( size_t cx=0; cx < count; ++cx ) {
+		s_cursor& cursor = cursors[cx];
+		const s_run& run = runs[first+cx];
+
+		cursor.fd = run.fd;
+		cursor.left = run.nrecs;
+		cursor.offset = 0;
+		cursor.buf.resize(std::min(per,size_t(run.nrecs)));
+		if ( cursor.fill() )
+			heap.push_back(cx);
+		else if ( cursor.left > 0 || run.nrecs > 0 )
+			return errno ? errno : EIO;
+	}
+	std::make_heap(heap.begin(),heap.end(),[this](unsigned a,unsigned b) {
+		return cursors[b].front() < cursors[a].front();
+	});
+	return 0;
+}
+
+bool
+ExtSort::pop(s_extrec& rec) {
+	auto greater = [this](unsigned a,unsigned b) {
+		return cursors[b].front() < cursors[a].front();
+	};
+
+	if ( heap.empty() )
+		return false;
+
+	std::pop_heap(heap.begin(),heap.end(),greater);
+
+	s_cursor& cursor = cursors[heap.back()];
+
+	rec = cursor.front();
+	if ( ++cursor.bx < cursor.bn || cursor.fill() )
+		std::push_heap(heap.begin(),heap.end(),greater);
+	else	{
+		if ( cursor.left > 0 ) {
+			int expected = 0;	// Read error
+
+			err.compare_exchange_strong(expected,errno ? errno : EIO);
+		}
+		heap.pop_back();
+	}
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Merge runs[first..first+count) into a new run in out
+//////////////////////////////////////////////////////////////////////
+
+int
+ExtSort::merge_runs(size_t first,size_t count,s_run& out) {
+	static const size_t wrecs = 4096;
+	std::vector<s_extrec> wbuf;
+	s_extrec rec;
+	int rc;
+
+	out.fd = temp_file();
+	out.nrecs = 0;
+	if ( out.fd < 0 )
+		return errno;
+
+	if ( (rc = open_cursors(first,count)) != 0 )
+		return rc;
+
+	wbuf.reserve(wrecs);
+	while ( pop(rec) ) {
+		wbuf.push_back(rec);
+		if ( wbuf.size() >= wrecs ) {
+			if ( (rc = write_all(out.fd,wbuf.data(),wbuf.size() * sizeof rec)) != 0 )
+				return rc;
+			out.nrecs += wbuf.size();
+			wbuf.clear();
+		}
+	}
+	if ( (rc = write_all(out.fd,wbuf.data(),wbuf.size() * sizeof rec)) != 0 )
+		return rc;
+	out.nrecs += wbuf.size();
+
+	for ( size_t rx=first; rx < first+count; ++rx ) {
+		::close(runs[rx].fd);
+		runs[rx].fd = -1;
+	}
+	return err.load();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Called after all records are added, to start reading them back.
+// When nothing was spilled, the records are sorted in memory.
+//////////////////////////////////////////////////////////////////////
+
+int
+ExtSort::finish() {
+	int rc;
+
+	if ( err.load() )
+		return err.load();
+
+	if ( runs.empty() ) {
+		cursors.clear();
+		heap.clear();
+		cursors.resize(1);
+
+		s_cursor& cursor = cursors[0];
+
+		cursor.fd = -1;
+		cursor.left = 0;
+		for ( auto& recs : buffers ) {
+			cursor.buf.insert(cursor.buf.end(),recs.begin(),recs.end());
+			std::vector<s_extrec>().swap(recs);
+		}
+		std::sort(cursor.buf.begin(),cursor.buf.end());
+		cursor.bn = cursor.buf.size();
+		nrecs = cursor.bn;
+		if ( cursor.bn > 0 )
+			heap.push_back(0);
+		return 0;
+	}
+
+	for ( auto& recs : buffers ) {
+		if ( !recs.empty() && (rc = write_run(recs)) != 0 )
+			return rc;
+		std::vector<s_extrec>().swap(recs);
+	}
+
+	while ( runs.size() > fanin ) {
+		std::vector<s_run> merged;
+
+		for ( size_t rx=0; rx < runs.size(); rx += fanin ) {
+			s_run out;
+
+			rc = merge_runs(rx,std::min(size_t(fanin),runs.size()-rx),out);
+			if ( out.fd >= 0 )
+				merged.push_back(out);
+			if ( rc ) {
+				for ( auto& run : runs )
+					if ( run.fd >= 0 )
+						::close(run.fd);
+				runs = std::move(merged);
+				return rc;
+			}
+		}
+		runs = std::move(merged);
+	}
+	return open_cursors(0,runs.size());
+}
+
+#ifdef UNIT_TEST
+
+//////////////////////////////////////////////////////////////////////
+// make test: records added by two writers come back in order, each
+// once. A small memory budget makes enough runs for the merge to
+// take more than one pass.
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <random>
+
+int
+main() {
+	const char *tmpdir = getenv("TMPDIR");
+	unsigned nchecks = 0, nfailed = 0;
+	std::mt19937_64 rng(1);
+
+	auto check = [&](bool ok,const char *what,size_t n) {
+		++nchecks;
+		if ( !ok ) {
+			fprintf(stderr,"FAILED: %s (%zu records)\n",what,n);
+			++nfailed;
+		}
+	};
+
+	for ( size_t n : { 0, 1, 5000, 300000 } ) {
+		ExtSort sorter;
+		std::vector<s_extrec> ref;
+		s_extrec rec;
+		size_t got = 0;
+		bool added = true, ordered = true;
+
+		sorter.open(tmpdir ? tmpdir : "/tmp",2,64 * 1024);
+		for ( size_t rx=0; rx < n; ++rx ) {
+			memset(&rec,0,sizeof rec);
+			rec.size = rng() % 1000;
+			rec.fprint = rng() % 4;
+			rec.dev = 1;
+			rec.ino = rng() % 100;
+			rec.name_off = rx;		// Makes the order total
+			ref.push_back(rec);
+			added &= sorter.add(rx & 1,rec);
+		}
+		check(added,"add",n);
+		if ( n > 100000 )
+			check(sorter.nruns() > 64,"more runs than one merge takes",n);
+		check(sorter.finish() == 0,"finish",n);
+
+		std::sort(ref.begin(),ref.end());
+		while ( sorter.next(rec) ) {
+			ordered &= got < ref.size() && memcmp(&rec,&ref[got],sizeof rec) == 0;
+			++got;
+		}
+		check(ordered && got == n,"merged order",n);
+		check(sorter.error_code() == 0,"no error",n);
+	}
+
+	printf("test_extsort: %u checks, %u failed\n",nchecks,nfailed);
+	return nfailed != 0;
+}
+
+#endif // UNIT_TEST
+
+// End extsort.cpp
@@ -0,0 +1,137 @@
+//////////////////////////////////////////////////////////////////////
+// extsort.hpp -- External merge sort of file records
+// Date: Sun Oct 18 09:41:15 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef EXTSORT_HPP
+#define EXTSORT_HPP
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+// A scanned file, as kept on disk. The name is not stored in the
+// record but in a NameLog, which records refer to by log and offset.
+// Records sort by size, fingerprint and inode, so hard links to the
+// same inode are adjacent.
+//////////////////////////////////////////////////////////////////////
+
+struct s_extrec {
+	uint64_t	size;		// File size in bytes
+	uint64_t	fprint;		// Fingerprint of first 1k (0 until known)
+	uint64_t	dev;		// Device number
+	uint64_t	ino;		// Inode number
+	uint64_t	name_off;	// Offset of name in its log
+	uint32_t	dir;		// Dirno_t of containing directory
+	uint16_t	name_len;	// Length of name
+	uint16_t	log;		// NameLog writer
+
+	bool same_inode(const s_extrec& other) const {
+		return dev == other.dev && ino == other.ino;
+	}
+	bool operator<(const s_extrec& other) const {
+		if ( size != other.size )
+			return size < other.size;
+		if ( fprint != other.fprint )
+			return fprint < other.fprint;
+		if ( dev != other.dev )
+			return dev < other.dev;
+		if ( ino != other.ino )
+			return ino < other.ino;
+		if ( log != other.log )
+			return log < other.log;
+		return name_off < other.name_off;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Append-only logs of file names, one per writer thread, kept in
+// unlinked temporary files.
+//////////////////////////////////////////////////////////////////////
+
+class NameLog {
+	static const size_t bufsiz = 65536;
+
+	struct s_log {
+		int		fd = -1;
+		uint64_t	offset = 0;	// Bytes logged, incl. buffered
+		std::string	buf;		// Not yet written
+	};
+	std::vector<s_log>	logs;
+	std::atomic<int>	err;
+
+	int write(s_log& log);
+
+public:	NameLog() : err(0) {}
+	~NameLog();
+	int open(const char *dir,unsigned nwriters);
+	bool append(unsigned thx,const char *name,s_extrec& rec);
+	int flush();
+	std::string name(const s_extrec& rec);
+	int error_code() { return err.load(); }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Records are added by writer threads into buffers of their own.
+// A full buffer is sorted and written out as a run. Once finish()
+// is called, next() returns all records in sorted order, merging
+// the runs (in more than one pass when there are many).
+//////////////////////////////////////////////////////////////////////
+
+class ExtSort {
+	static const unsigned fanin = 64;	// Runs merged at once
+
+	struct s_run {
+		int		fd;
+		uint64_t	nrecs;
+	};
+	struct s_cursor {
+		int		fd;
+		uint64_t	left;		// Records not yet buffered
+		off_t		offset;
+		std::vector<s_extrec> buf;
+		size_t		bx = 0;		// Next in buf
+		size_t		bn = 0;		// Records in buf
+
+		bool fill();
+		const s_extrec& front() const { return buf[bx]; }
+	};
+
+	std::string		dir;
+	size_t			max_recs;	// Per writer buffer
+	size_t			mem_bytes;
+	std::vector<std::vector<s_extrec>> buffers;
+	std::mutex		runs_mutex;
+	std::vector<s_run>	runs;
+	std::vector<s_cursor>	cursors;
+	std::vector<unsigned>	heap;		// Cursor indexes
+	std::atomic<int>	err;
+	uint64_t		nrecs;
+	uint64_t		nspilled;
+
+	int temp_file();
+	int write_run(std::vector<s_extrec>& recs);
+	int merge_runs(size_t first,size_t count,s_run& out);
+	int open_cursors(size_t first,size_t count);
+	bool pop(s_extrec& rec);
+
+public:	ExtSort() : max_recs(0), mem_bytes(0), err(0), nrecs(0), nspilled(0) {}
+	~ExtSort();
+	void open(const char *dir,unsigned nwriters,size_t mem_bytes);
+	bool add(unsigned thx,const s_extrec& rec);
+	int finish();
+	bool next(s_extrec& rec) { return pop(rec); }
+	int error_code() { return err.load(); }
+	size_t size() { return nrecs; }
+	size_t spilled() { return nspilled; }
+	size_t nruns() { return runs.size(); }
+};
+
+#endif // EXTSORT_HPP
+
+// End extsort.hpp
@@ -0,0 +1,136 @@
+//////////////////////////////////////////////////////////////////////
+// filter.cpp -- Compiled --include/--exclude rules for the walk
+// Date: Mon Oct 19 17:52:30 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <fnmatch.h>
+
+#include "filter.hpp"
+
+void
+PathFilter::add(const char *pattern,bool include) {
+	s_rule rule;
+	std::string pat(pattern);
+
+	rule.include = include;
+	rule.dir_only = pat.size() > 1 && pat.back() == '/';
+	if ( rule.dir_only )
+		pat.pop_back();
+	rule.path = pat.find('/') != std::string::npos;
+	if ( pat.size() > 1 && pat[0] == '/' )
+		pat.erase(0,1);			// Paths are below the root
+	any_path |= rule.path;
+
+	if ( pat.find_first_of("*?[\\") == std::string::npos ) {
+		rule.kind = s_rule::Literal;
+	} else if ( pat[0] == '*' && pat.find_first_of("*?[\\",1) == std::string::npos ) {
+		rule.kind = s_rule::Suffix;
+		pat.erase(0,1);
+	} else	rule.kind = s_rule::Glob;
+
+	rule.pattern = pat;
+	rules.push_back(rule);
+}
+
+bool
+PathFilter::match(const s_rule& rule,const char *subject) {
+
+	switch ( rule.kind ) {
+	case s_rule::Literal:
+		return rule.pattern == subject;
+	case s_rule::Suffix:
+		{
+			const size_t len = strlen(subject);
+
+			return len >= rule.pattern.size()
+				&& !memcmp(subject + len - rule.pattern.size(),rule.pattern.data(),rule.pattern.size());
+		}
+	default:
+		return fnmatch(rule.pattern.c_str(),subject,rule.path ? FNM_PATHNAME : 0) == 0;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// True when the entry name (at relpath below the root, when
+// needs_path()) is to be skipped
+//////////////////////////////////////////////////////////////////////
+
+bool
+PathFilter::excluded(const char *name,const std::string& relpath,bool is_dir) const {
+
+	for ( auto& rule : rules ) {
+		if ( rule.dir_only && !is_dir )
+			continue;
+		if ( match(rule,rule.path ? relpath.c_str() : name) )
+			return !rule.include;
+	}
+	return false;
+}
+
+#ifdef UNIT_TEST
+
+//////////////////////////////////////////////////////////////////////
+// make test: each kind of pattern, directory-only and path rules,
+// and first match wins
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+
+int
+main() {
+	static const struct {
+		const char	*rules;		// Space separated, +include -exclude
+		const char	*name;
+		const char	*relpath;
+		bool		is_dir;
+		bool		excluded;
+	} cases[] = {
+		{ "-*.o",		"a.o",		"a.o",		false,	true },
+		{ "-*.o",		"a.oo",		"a.oo",		false,	false },
+		{ "-*.o",		".o",		"sub/.o",	false,	true },
+		{ "-core",		"core",		"x/core",	false,	true },
+		{ "-core",		"core.1",	"core.1",	false,	false },
+		{ "-ca?he",		"cache",	"cache",	true,	true },
+		{ "-[ab]*.log",		"b1.log",	"b1.log",	false,	true },
+		{ "-[ab]*.log",		"c1.log",	"c1.log",	false,	false },
+		{ "-build/",		"build",	"build",	true,	true },
+		{ "-build/",		"build",	"build",	false,	false },
+		{ "-src/*.tmp",		"x.tmp",	"src/x.tmp",	false,	true },
+		{ "-src/*.tmp",		"x.tmp",	"src/sub/x.tmp", false,	false },
+		{ "-src/*.tmp",		"x.tmp",	"x.tmp",	false,	false },
+		{ "-/top",		"top",		"top",		true,	true },
+		{ "-/top",		"top",		"a/top",	true,	false },
+		{ "+keep.o -*.o",	"keep.o",	"keep.o",	false,	false },
+		{ "+keep.o -*.o",	"drop.o",	"drop.o",	false,	true },
+		{ "-*.o +keep.o",	"keep.o",	"keep.o",	false,	true },
+		{ "+*.c",		"a.h",		"a.h",		false,	false },
+	};
+	unsigned nfailed = 0;
+
+	for ( auto& tc : cases ) {
+		PathFilter filter;
+		std::string rules(tc.rules);
+		size_t from = 0;
+
+		while ( from < rules.size() ) {
+			size_t to = rules.find(' ',from);
+
+			if ( to == std::string::npos )
+				to = rules.size();
+			filter.add(rules.substr(from + 1,to - from - 1).c_str(),rules[from] == '+');
+			from = to + 1;
+		}
+		if ( filter.excluded(tc.name,tc.relpath,tc.is_dir) != tc.excluded ) {
+			fprintf(stderr,"FAILED: \"%s\" on %s%s\n",tc.rules,tc.relpath,tc.is_dir ? "/" : "");
+			++nfailed;
+		}
+	}
+
+	printf("test_filter: %zu checks, %u failed\n",sizeof cases / sizeof cases[0],nfailed);
+	return nfailed != 0;
+}
+
+#endif // UNIT_TEST
+
+// End filter.cpp
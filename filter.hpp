@@ -0,0 +1,47 @@
+//////////////////////////////////////////////////////////////////////
+// filter.hpp -- Compiled --include/--exclude rules for the walk
+// Date: Mon Oct 19 17:40:09 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef FILTER_HPP
+#define FILTER_HPP
+
+#include <string>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////
+// Rules are tried in the order given, and the first to match an
+// entry decides whether it is walked (--include) or skipped
+// (--exclude). An entry no rule matches is walked. A pattern is
+// matched against the entry's name, or when it holds a '/', against
+// its path below the root directory; a pattern ending in '/' only
+// matches directories.
+//
+// Patterns are compiled when added: a literal name is compared as a
+// string, and "*suffix" (as in *.o) by its tail, leaving fnmatch(3)
+// for the rest.
+//////////////////////////////////////////////////////////////////////
+
+class PathFilter {
+	struct s_rule {
+		enum Kind { Literal, Suffix, Glob } kind;
+		std::string	pattern;	// Suffix: without the '*'
+		bool		include;
+		bool		dir_only;	// Pattern ended in '/'
+		bool		path;		// Match the path below the root
+	};
+
+	std::vector<s_rule> rules;
+	bool		any_path = false;	// Some rule matches paths
+
+	static bool match(const s_rule& rule,const char *subject);
+
+public:	void add(const char *pattern,bool include);
+	bool empty() const { return rules.empty(); }
+	bool needs_path() const { return any_path; }
+	bool excluded(const char *name,const std::string& relpath,bool is_dir) const;
+};
+
+#endif // FILTER_HPP
+
+// End filter.hpp
@@ -0,0 +1,297 @@
+//////////////////////////////////////////////////////////////////////
+// fpcache.cpp -- Persistent fingerprint cache
+// Date: Sat Oct 17 14:09:12 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <libgen.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "fpcache.hpp"
+
+static const char cache_magic[8] = { 'D','E','D','U','P','F','P','1' };
+
+static_assert(sizeof(FpCache::s_record) == 64,"FpCache::s_record must be 64 bytes");
+
+static inline bool
+key_less(const FpCache::s_record& a,const FpCache::s_record& b) {
+	return a.dev < b.dev || ( a.dev == b.dev && a.ino < b.ino );
+}
+
+FpCache::FpCache()
+: fprint_hits(0), fprint_misses(0), hash_hits(0), hash_misses(0) {
+	kernel[0] = 0;
+}
+
+FpCache::~FpCache() {
+	close();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Map the cache file. A missing file is an empty cache, and so is a
+// file with a bad header (it is replaced on save). Cached prefix
+// fingerprints are only used if they came from the same kernel.
+//////////////////////////////////////////////////////////////////////
+
+int
+FpCache::open(const char *pathname,const char *kernel_name) {
+	struct stat sbuf;
+	s_header hdr;
+
+	close();
+	path = pathname;
+	strncpy(kernel,kernel_name,sizeof kernel-1);
+	kernel[sizeof kernel-1] = 0;
+
+	File_Guard fg(pathname);
+
+	if ( fg.fd < 0 )
+		return fg.error == ENOENT ? 0 : fg.error;
+
+	if ( fstat(fg.fd,&sbuf) == -1 )
+		return errno;
+	if ( size_t(sbuf.st_size) < sizeof hdr )
+		return 0;
+	if ( fg.read(&hdr,sizeof hdr,0) != int(sizeof hdr)
+	  || memcmp(hdr.magic,cache_magic,sizeof hdr.magic) != 0
+	  || hdr.recsize != sizeof(s_record)
+	  || hdr.count != (size_t(sbuf.st_size) - sizeof hdr) / sizeof(s_record)
+	  || (size_t(sbuf.st_size) - sizeof hdr) % sizeof(s_record) != 0 ) {
+		fprintf(stderr,"Ignoring invalid fingerprint cache %s\n",pathname);
+		return 0;
+	}
+
+	if ( hdr.count > 0 ) {
+		maplen = sbuf.st_size;
+		map = mmap(nullptr,maplen,PROT_READ,MAP_SHARED,fg.fd,0);
+		if ( map == MAP_FAILED ) {
+			map = nullptr;
+			maplen = 0;
+			return errno;
+		}
+		records = (const s_record *)((const char *)map + sizeof hdr);
+		count = hdr.count;
+	}
+	kernel_ok = !strncmp(hdr.kernel,kernel,sizeof hdr.kernel);
+	return 0;
+}
+
+void
+FpCache::close() {
+	if ( map ) {
+		munmap(map,maplen);
+		map = nullptr;
+		maplen = 0;
+	}
+	records = nullptr;
+	count = 0;
+	path.clear();
+}
+
+const FpCache::s_record *
+FpCache::find(uint64_t dev,uint64_t ino) const {
+	s_record key;
+
+	key.dev = dev;
+	key.ino = ino;
+
+	const s_record *end = records + count;
+	const s_record *rp = std::lower_bound(records,end,key,key_less);
+
+	if ( rp == end || rp->dev != dev || rp->ino != ino )
+		return nullptr;
+	return rp;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Find the valid record for a file: same inode, size and mtime.
+//////////////////////////////////////////////////////////////////////
+
+const FpCache::s_record *
+FpCache::find(GlobalFiles& files,Fileno_t file) const {
+	const s_record *rp = find(files.st_dev(file),files.st_ino(file));
+	const s_file_ent& fent = files.lookup(file);
+
+	if ( !rp
+	  || rp->size != files.st_size(file)
+	  || rp->mtime_sec != fent.st_mtimespec.tv_sec
+	  || rp->mtime_nsec != fent.st_mtimespec.tv_nsec )
+		return nullptr;
+	return rp;
+}
+
+bool
+FpCache::lookup_fprint(GlobalFiles& files,Fileno_t file) {
+	const s_record *rp = kernel_ok ? find(files,file) : nullptr;
+
+	if ( !rp || !(rp->flags & Has_fprint) ) {
+		++fprint_misses;
+		return false;
+	}
+	files.fprint(file) = rp->fprint;
+	files.lookup(file).fprint_ok = true;
+	++fprint_hits;
+	return true;
+}
+
+bool
+FpCache::lookup_hash(GlobalFiles& files,Fileno_t file) {
+	const s_record *rp = find(files,file);
+	s_file_ent& fent = files.lookup(file);
+
+	if ( !rp || !(rp->flags & Has_hash) ) {
+		++hash_misses;
+		return false;
+	}
+	fent.hash.h1 = rp->hash_h1;
+	fent.hash.h2 = rp->hash_h2;
+	fent.hash_ok = true;
+	++hash_hits;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write the cache back: one record for each registered file that has
+// a fingerprint or hash (computed now or still valid from before),
+// plus the old records of files that were not seen in this run, for
+// up to keep saves. Files modified within the last two seconds are
+// left out, since a later change within the same timestamp tick
+// would go unnoticed.
+//
+// The new file is written and synced under a unique temporary name
+// (so that concurrent runs do not write into each other's), then
+// renamed over the old one, so a crash leaves one or the other.
+//////////////////////////////////////////////////////////////////////
+
+int
+FpCache::save(GlobalFiles& files,unsigned keep) {
+	const time_t now = time(nullptr);
+	std::vector<s_record> recs;
+	std::string tmppath;
+	s_header hdr;
+	int rc = 0;
+
+	if ( path.empty() )
+		return EINVAL;
+
+	files.for_each([&](Fileno_t file) {
+		const s_file_ent& fent = files.lookup(file);
+		const s_record *rp = find(files,file);
+		s_record rec;
+
+		memset(&rec,0,sizeof rec);
+		if ( rp ) {
+			rec = *rp;
+			if ( !kernel_ok )
+				rec.flags &= ~Has_fprint;
+		}
+		rec.dev = files.st_dev(file);
+		rec.ino = files.st_ino(file);
+		rec.size = files.st_size(file);
+		rec.mtime_sec = fent.st_mtimespec.tv_sec;
+		rec.mtime_nsec = fent.st_mtimespec.tv_nsec;
+		rec.age = 0;
+		if ( files.error(file) != 0 || rec.mtime_sec + 2 > now )
+			rec.flags = 0;
+		else	{
+			if ( fent.fprint_ok ) {
+				rec.fprint = files.fprint(file);
+				rec.flags |= Has_fprint;
+			}
+			if ( fent.hash_ok ) {
+				rec.hash_h1 = fent.hash.h1;
+				rec.hash_h2 = fent.hash.h2;
+				rec.flags |= Has_hash;
+			}
+		}
+		recs.push_back(rec);
+	});
+
+	std::sort(recs.begin(),recs.end(),key_less);
+
+	// Carry over records of files not seen in this run
+	const size_t nseen = recs.size();
+
+	for ( size_t rx=0; rx < count; ++rx ) {
+		s_record rec = records[rx];
+
+		if ( std::binary_search(recs.begin(),recs.begin()+nseen,rec,key_less) )
+			continue;		// Seen: replaced above
+		if ( ++rec.age > keep )
+			continue;		// Expired
+		if ( !kernel_ok )
+			rec.flags &= ~Has_fprint;
+		recs.push_back(rec);
+	}
+
+	recs.erase(std::remove_if(recs.begin(),recs.end(),
+		[](const s_record& rec) { return rec.flags == 0; }),recs.end());
+	std::sort(recs.begin(),recs.end(),key_less);
+
+	memset(&hdr,0,sizeof hdr);
+	memcpy(hdr.magic,cache_magic,sizeof hdr.magic);
+	hdr.recsize = sizeof(s_record);
+	hdr.count = recs.size();
+	strncpy(hdr.kernel,kernel,sizeof hdr.kernel);
+
+	tmppath = path + ".XXXXXX";
+
+	int fd = mkstemp(&tmppath[0]);
+
+	if ( fd == -1 )
+		return errno;
+
+	const mode_t mask = umask(0);		// mkstemp() made it 0600
+
+	umask(mask);
+	fchmod(fd,0644 & ~mask);
+
+	auto write_all = [fd](const void *buf,size_t bytes) -> int {
+		const char *cp = (const char *)buf;
+
+		while ( bytes > 0 ) {
+			ssize_t n = ::write(fd,cp,bytes);
+
+			if ( n == -1 ) {
+				if ( errno == EINTR )
+					continue;
+				return errno;
+			}
+			cp += n;
+			bytes -= n;
+		}
+		return 0;
+	};
+
+	rc = write_all(&hdr,sizeof hdr);
+	if ( !rc && !recs.empty() )
+		rc = write_all(recs.data(),recs.size() * sizeof(s_record));
+	if ( !rc && fsync(fd) == -1 )
+		rc = errno;
+	if ( ::close(fd) == -1 && !rc )
+		rc = errno;
+	if ( !rc && rename(tmppath.c_str(),path.c_str()) == -1 )
+		rc = errno;
+	if ( rc ) {
+		unlink(tmppath.c_str());
+		return rc;
+	}
+
+	// Make the rename durable
+	std::string dirpath(path);
+	int dfd = ::open(dirname(&dirpath[0]),O_RDONLY|O_DIRECTORY);
+
+	if ( dfd >= 0 ) {
+		fsync(dfd);
+		::close(dfd);
+	}
+	return 0;
+}
+
+// End fpcache.cpp
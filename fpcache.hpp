@@ -0,0 +1,73 @@
+//////////////////////////////////////////////////////////////////////
+// fpcache.hpp -- Persistent fingerprint cache
+// Date: Sat Oct 17 14:05:31 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef FPCACHE_HPP
+#define FPCACHE_HPP
+
+#include "system.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// The cache file is a 64-byte header followed by fixed size records
+// sorted by (st_dev,st_ino). It is mapped read-only and searched in
+// place. A record is only used when st_size and st_mtimespec still
+// match. save() writes a new file and renames it over the old one.
+//////////////////////////////////////////////////////////////////////
+
+class FpCache {
+public:	struct s_record {
+		uint64_t	dev;		// st_dev
+		uint64_t	ino;		// st_ino
+		int64_t		size;		// st_size
+		int64_t		mtime_sec;	// st_mtimespec
+		int32_t		mtime_nsec;
+		uint16_t	flags;		// Has_fprint | Has_hash
+		uint16_t	age;		// Saves since file was last seen
+		uint64_t	fprint;		// First 1-k fingerprint
+		uint64_t	hash_h1;	// Full content hash
+		uint64_t	hash_h2;
+	};
+	enum {
+		Has_fprint = 0x0001,
+		Has_hash = 0x0002
+	};
+
+private:
+	struct s_header {
+		char		magic[8];	// "DEDUPFP1"
+		uint32_t	recsize;	// sizeof(s_record)
+		uint32_t	reserved;
+		uint64_t	count;		// # of records
+		char		kernel[16];	// Fingerprint kernel name
+		uint8_t		pad[24];
+	};
+
+	std::string		path;		// Cache file pathname
+	void			*map = nullptr;	// Mapped cache file
+	size_t			maplen = 0;
+	const s_record		*records = nullptr;
+	size_t			count = 0;
+	char			kernel[16];	// Current kernel name
+	bool			kernel_ok = false; // Cached fprints usable
+
+	const s_record *find(GlobalFiles& files,Fileno_t file) const;
+	const s_record *find(uint64_t dev,uint64_t ino) const;
+
+public:	std::atomic<uint64_t>	fprint_hits, fprint_misses;
+	std::atomic<uint64_t>	hash_hits, hash_misses;
+
+	FpCache();
+	~FpCache();
+	int open(const char *pathname,const char *kernel_name);
+	void close();
+	inline bool is_open() { return !path.empty(); }
+	bool lookup_fprint(GlobalFiles& files,Fileno_t file);
+	bool lookup_hash(GlobalFiles& files,Fileno_t file);
+	int save(GlobalFiles& files,unsigned keep);
+	size_t size() { return count; }
+};
+
+#endif // FPCACHE_HPP
+
+// End fpcache.hpp
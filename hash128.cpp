@@ -0,0 +1,123 @@
+//////////////////////////////////////////////////////////////////////
+// hash128.cpp -- Streaming 128-bit content hash
+// Date: Sat Oct 17 09:14:02 2026   (C) datablocks.net
+//
+// Based on MurmurHash3_x64_128 by Austin Appleby, which was placed
+// in the public domain. The block and finalization steps are
+// unchanged, so results match the reference implementation.
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "hash128.hpp"
+
+static const uint64_t c1 = 0x87c37b91114253d5ULL;
+static const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+static inline uint64_t
+rotl64(uint64_t x,int8_t r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+fmix64(uint64_t k) {
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return k;
+}
+
+void
+Hash128::reset(uint64_t seed) {
+	h1 = h2 = seed;
+	length = 0;
+	ntail = 0;
+}
+
+void
+Hash128::block(const uint8_t *data) {
+	uint64_t k1, k2;
+
+	memcpy(&k1,data,sizeof k1);
+	memcpy(&k2,data+8,sizeof k2);
+
+	k1 *= c1; k1 = rotl64(k1,31); k1 *= c2; h1 ^= k1;
+	h1 = rotl64(h1,27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+	k2 *= c2; k2 = rotl64(k2,33); k2 *= c1; h2 ^= k2;
+	h2 = rotl64(h2,31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+}
+
+void
+Hash128::update(const void *buf,size_t buflen) {
+	const uint8_t *data = (const uint8_t *)buf;
+
+	length += buflen;
+
+	if ( ntail > 0 ) {
+		size_t n = sizeof tail - ntail;
+
+		if ( n > buflen )
+			n = buflen;
+		memcpy(tail+ntail,data,n);
+		ntail += n;
+		data += n;
+		buflen -= n;
+		if ( ntail < sizeof tail )
+			return;
+		block(tail);
+		ntail = 0;
+	}
+
+	for ( ; buflen >= 16; data += 16, buflen -= 16 )
+		block(data);
+
+	if ( buflen > 0 ) {
+		memcpy(tail,data,buflen);
+		ntail = buflen;
+	}
+}
+
+hash128_t
+Hash128::final() {
+	uint64_t k1 = 0, k2 = 0;
+	hash128_t r;
+
+	switch ( ntail ) {
+	case 15: k2 ^= uint64_t(tail[14]) << 48;	// Fall thru
+	case 14: k2 ^= uint64_t(tail[13]) << 40;	// Fall thru
+	case 13: k2 ^= uint64_t(tail[12]) << 32;	// Fall thru
+	case 12: k2 ^= uint64_t(tail[11]) << 24;	// Fall thru
+	case 11: k2 ^= uint64_t(tail[10]) << 16;	// Fall thru
+	case 10: k2 ^= uint64_t(tail[9]) << 8;		// Fall thru
+	case  9: k2 ^= uint64_t(tail[8]);
+		k2 *= c2; k2 = rotl64(k2,33); k2 *= c1; h2 ^= k2;
+		// Fall thru
+	case  8: k1 ^= uint64_t(tail[7]) << 56;		// Fall thru
+	case  7: k1 ^= uint64_t(tail[6]) << 48;		// Fall thru
+	case  6: k1 ^= uint64_t(tail[5]) << 40;		// Fall thru
+	case  5: k1 ^= uint64_t(tail[4]) << 32;		// Fall thru
+	case  4: k1 ^= uint64_t(tail[3]) << 24;		// Fall thru
+	case  3: k1 ^= uint64_t(tail[2]) << 16;		// Fall thru
+	case  2: k1 ^= uint64_t(tail[1]) << 8;		// Fall thru
+	case  1: k1 ^= uint64_t(tail[0]);
+		k1 *= c1; k1 = rotl64(k1,31); k1 *= c2; h1 ^= k1;
+	}
+
+	uint64_t f1 = h1 ^ length, f2 = h2 ^ length;
+
+	f1 += f2;
+	f2 += f1;
+	f1 = fmix64(f1);
+	f2 = fmix64(f2);
+	f1 += f2;
+	f2 += f1;
+
+	r.h1 = f1;
+	r.h2 = f2;
+	return r;
+}
+
+// End hash128.cpp
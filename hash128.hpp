@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////////////////
+// hash128.hpp -- Streaming 128-bit content hash
+// Date: Sat Oct 17 09:12:40 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef HASH128_HPP
+#define HASH128_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct hash128_t {
+	uint64_t	h1 = 0;
+	uint64_t	h2 = 0;
+
+	bool operator==(const hash128_t& other) const {
+		return h1 == other.h1 && h2 == other.h2;
+	}
+	bool operator!=(const hash128_t& other) const {
+		return !(*this == other);
+	}
+	bool operator<(const hash128_t& other) const {
+		return h1 < other.h1 || ( h1 == other.h1 && h2 < other.h2 );
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// MurmurHash3 x64 128-bit, made incremental so that a file can be
+// hashed a buffer at a time (the tail of each update is carried
+// over to the next call).
+//////////////////////////////////////////////////////////////////////
+
+class Hash128 {
+	uint64_t	h1, h2;
+	uint64_t	length;		// Total bytes hashed
+	uint8_t		tail[16];	// Carried partial block
+	unsigned	ntail;		// Bytes in tail[]
+
+	void block(const uint8_t *data);
+
+public:	Hash128(uint64_t seed=0) { reset(seed); }
+	void reset(uint64_t seed=0);
+	void update(const void *buf,size_t buflen);
+	hash128_t final();
+};
+
+#endif // HASH128_HPP
+
+// End hash128.hpp
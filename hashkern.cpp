@@ -0,0 +1,303 @@
+//////////////////////////////////////////////////////////////////////
+// hashkern.cpp -- Prefix fingerprint kernels
+// Date: Sat Oct 17 11:42:51 2026   (C) datablocks.net
+//
+// The fingerprint of each candidate's first 1k is computed by one
+// of the kernels below, chosen by --hash. The CRC families pick
+// their fastest implementation from CPUID at startup.
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "hashkern.hpp"
+#include "hash128.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// xxHash64, after the reference implementation by Yann Collet
+// (BSD 2-clause). Results match XXH64().
+//////////////////////////////////////////////////////////////////////
+
+static const uint64_t P1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t P2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t P3 = 0x165667B19E3779F9ULL;
+static const uint64_t P4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t P5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t
+rotl64(uint64_t x,int r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t
+load64(const uint8_t *p) {
+	uint64_t w;
+
+	memcpy(&w,p,sizeof w);
+	return w;
+}
+
+static inline uint64_t
+xxround(uint64_t acc,uint64_t input) {
+	acc += input * P2;
+	acc = rotl64(acc,31);
+	return acc * P1;
+}
+
+static inline uint64_t
+xxmerge(uint64_t acc,uint64_t val) {
+	acc ^= xxround(0,val);
+	return acc * P1 + P4;
+}
+
+uint64_t
+xxh64(const void *buf,size_t buflen,uint64_t seed) {
+	const uint8_t *p = (const uint8_t *)buf;
+	const uint8_t *end = p + buflen;
+	uint64_t h;
+
+	if ( buflen >= 32 ) {
+		uint64_t v1 = seed + P1 + P2, v2 = seed + P2;
+		uint64_t v3 = seed, v4 = seed - P1;
+
+		for ( ; p + 32 <= end; p += 32 ) {
+			v1 = xxround(v1,load64(p));
+			v2 = xxround(v2,load64(p+8));
+			v3 = xxround(v3,load64(p+16));
+			v4 = xxround(v4,load64(p+24));
+		}
+		h = rotl64(v1,1) + rotl64(v2,7) + rotl64(v3,12) + rotl64(v4,18);
+		h = xxmerge(h,v1);
+		h = xxmerge(h,v2);
+		h = xxmerge(h,v3);
+		h = xxmerge(h,v4);
+	} else	h = seed + P5;
+
+	h += buflen;
+
+	for ( ; p + 8 <= end; p += 8 ) {
+		h ^= xxround(0,load64(p));
+		h = rotl64(h,27) * P1 + P4;
+	}
+	if ( p + 4 <= end ) {
+		uint32_t w;
+
+		memcpy(&w,p,sizeof w);
+		h ^= uint64_t(w) * P1;
+		h = rotl64(h,23) * P2 + P3;
+		p += 4;
+	}
+	for ( ; p < end; ++p ) {
+		h ^= *p * P5;
+		h = rotl64(h,11) * P1;
+	}
+
+	h ^= h >> 33;
+	h *= P2;
+	h ^= h >> 29;
+	h *= P3;
+	h ^= h >> 32;
+	return h;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Kernel table
+//////////////////////////////////////////////////////////////////////
+
+static bool
+always() {
+	return true;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static bool
+has_sse42() {
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("sse4.2");
+}
+
+static bool
+has_pclmul() {
+	return has_sse42() && __builtin_cpu_supports("pclmul");
+}
+#endif
+
+static fprint_t
+k_xxh64(const void *buf,size_t buflen) {
+	return xxh64(buf,buflen);
+}
+
+static fprint_t
+k_murmur128(const void *buf,size_t buflen) {
+	Hash128 h;
+
+	h.update(buf,buflen);
+	return h.final().h1;
+}
+
+static fprint_t
+k_crc32_sb8(const void *buf,size_t buflen) {
+	return crc32_sb8(0,buf,buflen);
+}
+
+static fprint_t
+k_crc32_sb16(const void *buf,size_t buflen) {
+	return crc32_sb16(0,buf,buflen);
+}
+
+static fprint_t
+k_crc32c_sb8(const void *buf,size_t buflen) {
+	return crc32c_sb8(0,buf,buflen);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static fprint_t
+k_crc32_pclmul(const void *buf,size_t buflen) {
+	return crc32_pclmul(0,buf,buflen);
+}
+
+static fprint_t
+k_crc32c_sse42(const void *buf,size_t buflen) {
+	return crc32c_sse42(0,buf,buflen);
+}
+#endif
+
+// In order of preference within each family
+static const s_hashkern kernels[] = {
+	{ "xxh64",	"xxHash64",				64,	k_xxh64,	always },
+	{ "murmur128",	"MurmurHash3 x64_128, first 64 bits",	64,	k_murmur128,	always },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "crc32-pclmul", "CRC-32 (gzip), PCLMULQDQ folding",	32,	k_crc32_pclmul,	has_pclmul },
+#endif
+	{ "crc32-sb16",	"CRC-32 (gzip), slice-by-16",		32,	k_crc32_sb16,	always },
+	{ "crc32-sb8",	"CRC-32 (gzip), slice-by-8",		32,	k_crc32_sb8,	always },
+#if defined(__x86_64__) || defined(__i386__)
+	{ "crc32c-sse42", "CRC-32C, SSE4.2 crc32 instruction",	32,	k_crc32c_sse42,	has_sse42 },
+#endif
+	{ "crc32c-sb8",	"CRC-32C, slice-by-8",			32,	k_crc32c_sb8,	always },
+	{ nullptr,	nullptr,				0,	nullptr,	nullptr }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Look up a kernel by name. A family name ("crc32", "crc32c") or
+// "auto" selects the first kernel that the CPU supports. Returns
+// nullptr for an unknown or unsupported kernel.
+//////////////////////////////////////////////////////////////////////
+
+const s_hashkern *
+HashKernel::lookup(const char *name) {
+	size_t nlen = strlen(name);
+
+	if ( !strcmp(name,"auto") )
+		return best();
+
+	for ( const s_hashkern *kp = kernels; kp->name; ++kp ) {
+		if ( !strcmp(kp->name,name) )
+			return kp->supported() ? kp : nullptr;
+	}
+	for ( const s_hashkern *kp = kernels; kp->name; ++kp ) {
+		if ( !strncmp(kp->name,name,nlen) && kp->name[nlen] == '-' && kp->supported() )
+			return kp;
+	}
+	return nullptr;
+}
+
+//////////////////////////////////////////////////////////////////////
+// The default: the widest fingerprint, which also runs well on
+// any CPU.
+//////////////////////////////////////////////////////////////////////
+
+const s_hashkern *
+HashKernel::best() {
+	return &kernels[0];
+}
+
+void
+HashKernel::list(FILE *out) {
+	for ( const s_hashkern *kp = kernels; kp->name; ++kp )
+		fprintf(out,"  %-14s %2u bits  %s%s\n",
+			kp->name,kp->bits,kp->descr,
+			kp->supported() ? "" : " (not supported by this CPU)");
+}
+
+#ifdef UNIT_TEST
+
+//////////////////////////////////////////////////////////////////////
+// make test: known answers for each kernel this CPU runs, and each
+// CRC kernel against the slice-by-8 one of its family, over lengths
+// and alignments that reach every tail and folding path
+//////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <random>
+#include <vector>
+
+static unsigned nchecks = 0, nfailed = 0;
+
+static void
+check(bool ok,const char *what,const char *name="") {
+
+	++nchecks;
+	if ( !ok ) {
+		fprintf(stderr,"FAILED: %s %s\n",what,name);
+		++nfailed;
+	}
+}
+
+int
+main() {
+	static const char digits[] = "123456789";
+	static const char fox[] = "The quick brown fox jumps over the lazy dog";
+	static const char spam[] = "Nobody inspects the spammish repetition";
+	std::vector<unsigned char> buf(8192 + 64);
+	std::mt19937 rng(1);
+
+	for ( auto& byte : buf )
+		byte = rng();
+
+	check(xxh64("",0) == 0xEF46DB3751D8E999ULL,"xxh64 \"\"");
+	check(xxh64("abc",3) == 0x44BC2CF5AD770999ULL,"xxh64 abc");
+	check(xxh64(spam,strlen(spam)) == 0xFBCEA83C8A378BF1ULL,"xxh64 spam");
+
+	{
+		Hash128 h, parts;
+		size_t off = 0;
+
+		h.update(fox,strlen(fox));
+		for ( size_t len : { 1, 7, 16, 19 } ) {	// Carries a tail over
+			parts.update(fox + off,len);
+			off += len;
+		}
+		const hash128_t a = h.final(), b = parts.final();
+
+		check(a.h1 == 0xE34BBC7BBC071B6CULL && a.h2 == 0x7A433CA9C49A9347ULL,"murmur128 fox");
+		check(a.h1 == b.h1 && a.h2 == b.h2,"murmur128 in parts");
+	}
+
+	for ( const s_hashkern *kp = kernels; kp->name; ++kp ) {
+		const bool crc32c = !strncmp(kp->name,"crc32c",6);
+		uint32_t (*ref)(uint32_t,const void *,size_t) = crc32c ? crc32c_sb8 : crc32_sb8;
+
+		if ( !kp->supported() ) {
+			printf("  %s: not supported by this CPU\n",kp->name);
+			continue;
+		}
+		if ( strncmp(kp->name,"crc32",5) != 0 )
+			continue;
+
+		check(kp->func(digits,9) == (crc32c ? 0xE3069283u : 0xCBF43926u),"check value",kp->name);
+
+		bool agree = true;
+
+		for ( size_t align=0; align < 16; ++align )
+			for ( size_t len=0; len <= 8192; len += len < 300 ? 1 : 257 )
+				agree &= kp->func(buf.data() + align,len) == ref(0,buf.data() + align,len);
+		check(agree,"agrees with slice-by-8",kp->name);
+	}
+
+	printf("test_hashkern: %u checks, %u failed\n",nchecks,nfailed);
+	return nfailed != 0;
+}
+
+#endif // UNIT_TEST
+
+// End hashkern.cpp
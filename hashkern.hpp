@@ -0,0 +1,42 @@
+//////////////////////////////////////////////////////////////////////
+// hashkern.hpp -- Prefix fingerprint kernels
+// Date: Sat Oct 17 11:40:18 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef HASHKERN_HPP
+#define HASHKERN_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint64_t fprint_t;
+
+// CRC kernels (crc32.cpp), accumulating from crc=0
+uint32_t crc32_sb8(uint32_t crc,const void *buf,size_t buflen);
+uint32_t crc32_sb16(uint32_t crc,const void *buf,size_t buflen);
+uint32_t crc32c_sb8(uint32_t crc,const void *buf,size_t buflen);
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t crc32_pclmul(uint32_t crc,const void *buf,size_t buflen);
+uint32_t crc32c_sse42(uint32_t crc,const void *buf,size_t buflen);
+#endif
+
+uint64_t xxh64(const void *buf,size_t buflen,uint64_t seed=0);
+
+struct s_hashkern {
+	const char	*name;		// Name for --hash
+	const char	*descr;		// Description for --hash list
+	unsigned	bits;		// Width of the fingerprint
+	fprint_t	(*func)(const void *buf,size_t buflen);
+	bool		(*supported)();	// CPU check
+};
+
+class HashKernel {
+public:	static const s_hashkern *lookup(const char *name);
+	static const s_hashkern *best();
+	static void list(FILE *out);
+};
+
+#endif // HASHKERN_HPP
+
+// End hashkern.hpp
@@ -0,0 +1,407 @@
+//////////////////////////////////////////////////////////////////////
+// ioengine.cpp -- Sequential file reading engines
+// Date: Sun Oct 18 16:19:22 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+#include <mutex>
+
+#include "ioengine.hpp"
+#include "metrics.hpp"
+
+IoEngine FileReader::engine = IoEngine::Pread;
+PageCache FileReader::pagecache = PageCache::Keep;
+size_t FileReader::chunk = 1024 * 1024;
+thread_local FileReader::s_busjmp *FileReader::busjmp = nullptr;
+
+static const size_t page_size = 4096;	// Buffer alignment
+static const size_t max_pooled = 16;	// Buffers kept per thread
+
+//////////////////////////////////////////////////////////////////////
+// Per-thread pool of aligned read buffers
+//////////////////////////////////////////////////////////////////////
+
+struct s_buffer_pool {
+	std::vector<std::pair<size_t,char *>> bufs;	// Size, buffer
+
+	~s_buffer_pool() {
+		for ( auto& pair : bufs )
+			::free(pair.second);
+	}
+	char *get(size_t size) {
+		for ( size_t bx=0; bx < bufs.size(); ++bx )
+			if ( bufs[bx].first == size ) {
+				char *buf = bufs[bx].second;
+
+				bufs[bx] = bufs.back();
+				bufs.pop_back();
+				return buf;
+			}
+
+		void *mem = nullptr;
+
+		if ( posix_memalign(&mem,page_size,size) != 0 )
+			return nullptr;
+		return (char *)mem;
+	}
+	void put(size_t size,char *buf) {
+		if ( bufs.size() < max_pooled )
+			bufs.emplace_back(size,buf);
+		else	::free(buf);
+	}
+};
+
+static thread_local s_buffer_pool buffer_pool;
+
+bool
+FileReader::parse(const char *name,IoEngine& engine) {
+
+	if ( !strcmp(name,"pread") )
+		engine = IoEngine::Pread;
+	else if ( !strcmp(name,"mmap") )
+		engine = IoEngine::Mmap;
+	else if ( !strcmp(name,"uring") )
+		engine = IoEngine::Uring;
+	else	return false;
+	return true;
+}
+
+bool
+FileReader::parse(const char *name,PageCache& pagecache) {
+
+	if ( !strcmp(name,"keep") )
+		pagecache = PageCache::Keep;
+	else if ( !strcmp(name,"dontneed") )
+		pagecache = PageCache::Dontneed;
+	else if ( !strcmp(name,"direct") )
+		pagecache = PageCache::Direct;
+	else	return false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// SIGBUS from a mapping, inside guard(): back out of it. Elsewhere,
+// the default action is restored, and the fault repeats with it.
+//////////////////////////////////////////////////////////////////////
+
+void
+FileReader::on_sigbus(int sig,siginfo_t *info,void *context) {
+
+	if ( busjmp ) {
+		busjmp->addr = info->si_addr;
+		siglongjmp(busjmp->env,1);
+	}
+	signal(sig,SIG_DFL);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Open path for reading blksiz bytes at a time (default chunk).
+// A prefix read takes a single small block (a page by default) from
+// the start of the file, or a few from here and there, so it gets no
+// readahead. Returns the fd, or -1 with error set.
+//////////////////////////////////////////////////////////////////////
+
+int
+FileReader::open(const char *path,size_t blksiz,bool prefix) {
+	const int flags = O_RDONLY|O_CLOEXEC;
+	struct stat sbuf;
+
+	close();
+	bufsiz = blksiz ? blksiz : prefix ? page_size : chunk;
+	direct = eof = false;
+	dontneed = pagecache == PageCache::Dontneed;
+
+	if ( pagecache == PageCache::Direct ) {
+#ifdef O_DIRECT
+		fd = ::open(path,flags|O_DIRECT);
+		if ( fd >= 0 )
+			direct = true;
+		else if ( errno != EINVAL ) {
+			error = errno;
+			return -1;
+		}
+#endif
+		if ( !direct )
+			dontneed = true;	// Filesystem refuses O_DIRECT
+	}
+
+	if ( fd < 0 && (fd = ::open(path,flags)) == -1 ) {
+		error = errno;
+		return -1;
+	}
+	error = 0;
+	metrics.add(Metric::FilesRead);
+
+	if ( direct )
+		return fd;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(fd,0,0,prefix ? POSIX_FADV_RANDOM : POSIX_FADV_SEQUENTIAL);
+#endif
+
+	mapped = engine == IoEngine::Mmap && !prefix;
+	if ( mapped ) {
+		static std::once_flag once;
+
+		std::call_once(once,[]() {
+			struct sigaction act;
+
+			memset(&act,0,sizeof act);
+			act.sa_sigaction = on_sigbus;
+			act.sa_flags = SA_SIGINFO;
+			sigemptyset(&act.sa_mask);
+			sigaction(SIGBUS,&act,nullptr);
+		});
+	}
+	if ( (mapped || dontneed) && fstat(fd,&sbuf) == 0 && sbuf.st_size > 0 ) {
+		size = sbuf.st_size;
+		map = ::mmap(nullptr,size,PROT_READ,MAP_PRIVATE,fd,0);
+		if ( map == MAP_FAILED ) {
+			map = nullptr;		// Read it with pread instead
+			mapped = dontneed = false;
+		} else	{
+			if ( dontneed )
+				note_cached(0);
+			if ( mapped ) {
+				madvise(map,size,MADV_SEQUENTIAL);
+				madvise(map,std::min(size_t(size),bufsiz),MADV_WILLNEED);
+			}
+		}
+	} else	mapped = dontneed = false;
+	return fd;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Note which pages up to end (and a good way past it) are in the
+// page cache, before anything reads them. The lookahead stays ahead
+// of the kernel's readahead, which would otherwise have cached pages
+// by the time they are looked at.
+//////////////////////////////////////////////////////////////////////
+
+void
+FileReader::note_cached(off_t end) {
+	const off_t lookahead = std::max(off_t(64 * 1024 * 1024),off_t(bufsiz * 4));
+	const off_t from = cached_off + cached.size() * page_size;
+
+	if ( from >= size || end + lookahead / 2 < from )
+		return;
+
+	const off_t to = std::min(size,end + lookahead);
+	const size_t npages = cached.size();
+
+	cached.resize(npages + (to - from + page_size - 1) / page_size);
+	if ( mincore((char *)map + from,to - from,cached.data() + npages) != 0 )
+		std::fill(cached.begin() + npages,cached.end(),1);	// Drop nothing
+}
+
+//////////////////////////////////////////////////////////////////////
+// Drop the pages before upto that were not cached before they were
+// read. The page cache holds large folios, which are only dropped
+// when the range covers all of them, so each call goes back over the
+// last few MiB again.
+//////////////////////////////////////////////////////////////////////
+
+void
+FileReader::release(off_t upto) {
+	static const off_t overlap = 8 * 1024 * 1024;
+	const size_t npages = std::min(size_t((upto - cached_off) / page_size),cached.size());
+
+	if ( upto <= released )
+		return;
+
+	for ( size_t px=0; px < npages; ) {
+		size_t end = px;
+
+		while ( end < npages && !(cached[end] & 1) )
+			++end;
+		if ( end > px )
+			posix_fadvise(fd,cached_off + px * page_size,(end - px) * page_size,POSIX_FADV_DONTNEED);
+		px = end + 1;
+	}
+	released = cached_off + npages * page_size;
+
+	if ( released - cached_off > overlap ) {
+		const size_t nerase = (released - overlap - cached_off) / page_size;
+
+		cached.erase(cached.begin(),cached.begin() + nerase);
+		cached_off += nerase * page_size;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Read up to bytes at offset, setting data to point at them. Returns
+// the byte count (0 at end of file), or -1 with error set.
+//////////////////////////////////////////////////////////////////////
+
+ssize_t
+FileReader::read(off_t offset,size_t bytes,const char *& data) {
+	const off_t behind = offset & ~off_t(page_size - 1);
+
+	if ( mapped ) {
+		if ( offset >= size )
+			return 0;
+
+		const size_t n = std::min(bytes,size_t(size - offset));
+		const off_t ahead = (offset + n) & ~off_t(page_size - 1);
+
+		// Data returned earlier is no longer needed: unmap it, so
+		// that the resident set stays at a block or two
+		if ( behind > dropped ) {
+			madvise((char *)map + dropped,behind - dropped,MADV_DONTNEED);
+			dropped = behind;
+		}
+		if ( dontneed ) {
+			release(behind);
+			note_cached(offset + n);
+		}
+		if ( ahead < size )	// Start reading the next block
+			madvise((char *)map + ahead,std::min(size_t(size - ahead),n),MADV_WILLNEED);
+		data = (const char *)map + offset;
+		metrics.add(Metric::BytesRead,n);
+		return n;
+	}
+
+	if ( !buf ) {
+		buf = buffer_pool.get(bufsiz);
+		if ( !buf ) {
+			error = ENOMEM;
+			return -1;
+		}
+	}
+
+	size_t got = 0, want = std::min(bytes,bufsiz);
+
+	if ( direct ) {
+		// Whole pages, and nothing more once a read came up short
+		if ( eof )
+			return 0;
+		want = std::min(bufsiz,(want + page_size - 1) & ~(page_size - 1));
+	} else if ( dontneed ) {
+		release(behind);
+		note_cached(offset + want);
+	}
+
+	while ( got < want ) {
+		ssize_t rc = ::pread(fd,buf+got,want-got,offset+got);
+
+		if ( rc == -1 ) {
+			if ( errno == EINTR )
+				continue;
+			error = errno;
+			return -1;
+		}
+		if ( rc == 0 )
+			break;		// End of file
+		got += rc;
+		if ( direct && size_t(rc) % page_size != 0 ) {
+			eof = true;
+			break;
+		}
+	}
+	data = buf;
+	metrics.add(Metric::BytesRead,got);
+	return std::min(got,bytes);
+}
+
+void
+FileReader::close() {
+
+	if ( fd >= 0 && dontneed ) {
+		if ( mapped && size > dropped )
+			madvise((char *)map + dropped,size - dropped,MADV_DONTNEED);
+		release(size + page_size - 1);
+	}
+	if ( map ) {
+		::munmap(map,size);
+		map = nullptr;
+	}
+	if ( buf ) {
+		buffer_pool.put(bufsiz,buf);
+		buf = nullptr;
+	}
+	if ( fd >= 0 ) {
+		::close(fd);
+		fd = -1;
+	}
+	size = 0;
+	dropped = 0;
+	released = cached_off = 0;
+	cached.clear();
+	mapped = false;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Page cache residency of (the start of) a file
+//////////////////////////////////////////////////////////////////////
+
+bool
+CacheSample::resident(const std::string& path,std::vector<unsigned char>& vec) {
+	struct stat sbuf;
+	int fd = ::open(path.c_str(),O_RDONLY|O_CLOEXEC);
+	void *m;
+
+	vec.clear();
+	if ( fd == -1 )
+		return false;
+	if ( fstat(fd,&sbuf) != 0 || sbuf.st_size == 0 ) {
+		::close(fd);
+		return sbuf.st_size == 0;
+	}
+
+	const size_t len = std::min(size_t(sbuf.st_size),max_pages * page_size);
+
+	m = ::mmap(nullptr,len,PROT_READ,MAP_PRIVATE,fd,0);
+	::close(fd);
+	if ( m == MAP_FAILED )
+		return false;
+	vec.resize((len + page_size - 1) / page_size);
+	if ( mincore(m,len,vec.data()) != 0 )
+		vec.clear();
+	::munmap(m,len);
+	return !vec.empty();
+}
+
+void
+CacheSample::start() {
+
+	before.resize(paths.size());
+	for ( size_t px=0; px < paths.size(); ++px )
+		resident(paths[px],before[px]);
+}
+
+void
+CacheSample::report(FILE *out) {
+	std::vector<unsigned char> after;
+	uint64_t was = 0, now = 0, evicted = 0, added = 0;
+	const double mib = page_size / 1048576.0;
+
+	for ( size_t px=0; px < paths.size(); ++px ) {
+		resident(paths[px],after);
+
+		const size_t n = std::min(before[px].size(),after.size());
+
+		for ( size_t gx=0; gx < n; ++gx ) {
+			const bool b = before[px][gx] & 1, a = after[gx] & 1;
+
+			was += b;
+			now += a;
+			evicted += b && !a;
+			added += a && !b;
+		}
+	}
+	fprintf(out,"Page cache sample of %ld files: %.1f MiB cached before, %.1f after, "
+		"%.1f evicted, %.1f added\n",
+		long(paths.size()),was * mib,now * mib,evicted * mib,added * mib);
+}
+
+// End ioengine.cpp
@@ -0,0 +1,139 @@
+//////////////////////////////////////////////////////////////////////
+// ioengine.hpp -- Sequential file reading engines
+// Date: Sun Oct 18 16:05:48 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef IOENGINE_HPP
+#define IOENGINE_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+enum class IoEngine {
+	Pread,		// Large preads into pooled, aligned buffers
+	Mmap,		// Map the whole file, advise sequential access
+	Uring		// Batched io_uring reads (see uring.hpp), else pread
+};
+
+enum class PageCache {
+	Keep,		// Leave what was read in the page cache
+	Dontneed,	// Drop pages read that were not already cached
+	Direct		// Bypass the page cache with O_DIRECT
+};
+
+//////////////////////////////////////////////////////////////////////
+// Reads one file from start to end, a block at a time. read()
+// returns a pointer to the data rather than copying it, which for
+// the mmap engine points into the mapping.
+//
+// The pread engine takes its buffer from a per-thread pool, so that
+// a worker reading file after file reuses the same few buffers.
+// Both engines ask for sequential readahead with posix_fadvise().
+//
+// With PageCache::Dontneed, mincore() notes which pages were cached
+// before they are read, looking well ahead of the reads so that the
+// kernel's readahead cannot get there first. Once the caller is done
+// with a block (at the next read or close) the others are dropped.
+// PageCache::Direct reads with O_DIRECT and the pread engine, and
+// falls back to Dontneed where the filesystem refuses O_DIRECT.
+//////////////////////////////////////////////////////////////////////
+
+class FileReader {
+	struct s_busjmp {
+		sigjmp_buf	env;
+		const void	*addr;		// Faulting address
+	};
+	static thread_local s_busjmp *busjmp;	// Innermost guard()
+
+	int		fd = -1;
+	off_t		size = 0;	// Size when opened
+	void		*map = nullptr;	// Mmap engine, or for mincore()
+	bool		mapped = false;	// Data is read through map
+	bool		direct = false;	// Opened with O_DIRECT
+	bool		eof = false;	// Direct read came up short
+	bool		dontneed = false; // Drop pages after use
+	off_t		dropped = 0;	// Mapping released up to here
+	char		*buf = nullptr;	// Pread engine
+	size_t		bufsiz = 0;
+	off_t		released = 0;	// Dontneed done up to here
+	off_t		cached_off = 0;	// First page in cached
+	std::vector<unsigned char> cached;	// Pages cached before reading
+
+	void note_cached(off_t end);
+	void release(off_t upto);
+	static void on_sigbus(int sig,siginfo_t *info,void *context);
+
+public:	int		error = 0;
+
+	static IoEngine	engine;
+	static PageCache pagecache;
+	static size_t	chunk;		// Default block size
+
+	static bool parse(const char *name,IoEngine& engine);
+	static bool parse(const char *name,PageCache& pagecache);
+
+	FileReader() {}
+	FileReader(const FileReader&) = delete;
+	~FileReader() { close(); }
+	int open(const char *path,size_t blksiz=0,bool prefix=false);
+	ssize_t read(off_t offset,size_t bytes,const char *& data);
+	bool is_open() const { return fd >= 0; }
+	void close();
+
+	// True when addr lies in this reader's mapping
+	bool maps(const void *addr) const {
+		return mapped && addr >= map && addr < (const char *)map + size;
+	}
+
+	// Run func(), which uses data read. A file truncated under the
+	// mmap engine raises SIGBUS when the data past its new end is
+	// touched: guard() then returns false, with the faulting address
+	// in fault (see maps()).
+	template<typename F> static bool guard(F func,const void *& fault) {
+		s_busjmp jmp, *prev = busjmp;
+
+		if ( engine != IoEngine::Mmap ) {
+			func();
+			return true;
+		}
+		if ( sigsetjmp(jmp.env,1) ) {
+			busjmp = prev;
+			fault = jmp.addr;
+			return false;
+		}
+		busjmp = &jmp;
+		func();
+		busjmp = prev;
+		return true;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Samples page cache residency of a set of files with mincore(),
+// before and after the run, to show how much was evicted.
+//////////////////////////////////////////////////////////////////////
+
+class CacheSample {
+	static const size_t max_pages = 16384;	// Sampled per file
+
+	std::vector<std::string>		paths;
+	std::vector<std::vector<unsigned char>>	before;
+
+	static bool resident(const std::string& path,std::vector<unsigned char>& vec);
+
+public:	void add(const std::string& path) { paths.push_back(path); }
+	size_t size() const { return paths.size(); }
+	void start();
+	void report(FILE *out);
+};
+
+#endif // IOENGINE_HPP
+
+// End ioengine.hpp
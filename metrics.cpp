@@ -0,0 +1,247 @@
+//////////////////////////////////////////////////////////////////////
+// metrics.cpp -- Run counters, timers and the --stats report
+// Date: Sun Oct 18 22:31:47 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "metrics.hpp"
+
+Metrics metrics;
+
+static const char *counter_names[] = {
+	"dirs", "files", "links", "pruned",
+	"open_calls", "getdents_calls", "stat_calls", "close_calls",
+	"register_ns",
+	"names_lock_waits", "names_lock_wait_ns",
+	"files_lock_waits", "files_lock_wait_ns",
+	"files_read", "bytes_read", "fprint_bytes",
+	"fingerprints", "hashes", "compares", "probes",
+	"size_candidates", "fprint_candidates", "probe_candidates", "verify_bytes", "verified_bytes",
+	"dup_files",
+	"output_ns", "output_bytes"
+};
+
+static const char *peak_names[] = {
+	"dir_queue", "read_queue", "output_queue"
+};
+
+static_assert(sizeof counter_names / sizeof counter_names[0] == size_t(Metric::Count),"counter_names");
+static_assert(sizeof peak_names / sizeof peak_names[0] == size_t(Peak::Count),"peak_names");
+
+Metrics::Metrics() : nslots(0), last(ncounters,0), t_start(clock::now()), t0(t_start) {
+	for ( auto& s : slots ) {
+		for ( auto& counter : s.counters )
+			counter.store(0);
+		for ( auto& p : s.peaks )
+			p.store(0);
+	}
+}
+
+const char *
+Metrics::name(Metric metric) {
+	return counter_names[unsigned(metric)];
+}
+
+const char *
+Metrics::name(Peak peak) {
+	return peak_names[unsigned(peak)];
+}
+
+bool
+Metrics::parse(const char *name,bool& json) {
+
+	if ( !strcmp(name,"text") )
+		json = false;
+	else if ( !strcmp(name,"json") )
+		json = true;
+	else	return false;
+	return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+// This thread's slot, taken the first time it counts anything
+//////////////////////////////////////////////////////////////////////
+
+Metrics::s_slot&
+Metrics::slot() {
+	static thread_local s_slot *mine = nullptr;
+
+	if ( !mine )
+		mine = &slots[std::min(nslots++,max_slots - 1)];
+	return *mine;
+}
+
+std::vector<uint64_t>
+Metrics::totals() {
+	const unsigned n = std::min(nslots.load(),max_slots);
+	std::vector<uint64_t> sums(ncounters,0);
+
+	for ( unsigned sx=0; sx < n; ++sx )
+		for ( unsigned cx=0; cx < ncounters; ++cx )
+			sums[cx] += slots[sx].counters[cx].load(std::memory_order_relaxed);
+	return sums;
+}
+
+uint64_t
+Metrics::total(Metric metric) {
+	const unsigned n = std::min(nslots.load(),max_slots);
+	uint64_t sum = 0;
+
+	for ( unsigned sx=0; sx < n; ++sx )
+		sum += slots[sx].counters[unsigned(metric)].load(std::memory_order_relaxed);
+	return sum;
+}
+
+uint64_t
+Metrics::peak(Peak peak) {
+	const unsigned n = std::min(nslots.load(),max_slots);
+	uint64_t most = 0;
+
+	for ( unsigned sx=0; sx < n; ++sx )
+		most = std::max(most,slots[sx].peaks[unsigned(peak)].load(std::memory_order_relaxed));
+	return most;
+}
+
+void
+Metrics::start(clock::time_point t,const char *first) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	t_start = t0 = t;
+	current = first;
+}
+
+//////////////////////////////////////////////////////////////////////
+// End a phase of the run: note its time since the last one ended,
+// and what was counted in it. Returns the seconds taken. Phase next
+// (if any) is then under way.
+//////////////////////////////////////////////////////////////////////
+
+double
+Metrics::phase(const char *name,const char *next) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const auto now = clock::now();
+	std::vector<uint64_t> sums = totals();
+	s_phase ph;
+
+	ph.name = name;
+	ph.secs = std::chrono::duration<double>(now - t0).count();
+	ph.counters.resize(ncounters);
+	for ( unsigned cx=0; cx < ncounters; ++cx )
+		ph.counters[cx] = sums[cx] - last[cx];
+	phases.push_back(std::move(ph));
+	last = std::move(sums);
+	t0 = now;
+	current = next ? next : "";
+	return phases.back().secs;
+}
+
+Metrics::s_snapshot
+Metrics::snapshot() {
+	std::lock_guard<std::mutex> lock(mutex);
+	const auto now = clock::now();
+	s_snapshot snap;
+
+	snap.phase = current;
+	snap.elapsed = std::chrono::duration<double>(now - t_start).count();
+	snap.phase_secs = std::chrono::duration<double>(now - t0).count();
+	snap.totals = totals();
+	snap.in_phase.resize(ncounters);
+	for ( unsigned cx=0; cx < ncounters; ++cx )
+		snap.in_phase[cx] = snap.totals[cx] - last[cx];
+	return snap;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write the --stats report, as text or a JSON object
+//////////////////////////////////////////////////////////////////////
+
+void
+Metrics::report(FILE *out,bool json,unsigned nthreads,double first_result) {
+	std::lock_guard<std::mutex> lock(mutex);
+	const std::vector<uint64_t> sums = totals();
+	double wall = 0;
+
+	auto sum = [&](Metric metric) { return sums[unsigned(metric)]; };
+	auto of = [](const s_phase& ph,Metric metric) { return ph.counters[unsigned(metric)]; };
+
+	for ( auto& ph : phases )
+		wall += ph.secs;
+
+	// Files dropped at each stage (with --mem-limit, hard links count
+	// as files)
+	const uint64_t files = sum(Metric::Files);
+	const uint64_t by_size = files - std::min(files,sum(Metric::SizeCandidates));
+	const uint64_t by_fprint = sum(Metric::SizeCandidates) - std::min(sum(Metric::SizeCandidates),sum(Metric::FprintCandidates));
+	const uint64_t by_probe = sum(Metric::FprintCandidates) - std::min(sum(Metric::FprintCandidates),sum(Metric::ProbeCandidates));
+	const uint64_t by_content = sum(Metric::ProbeCandidates) - std::min(sum(Metric::ProbeCandidates),sum(Metric::DupFiles));
+
+	if ( json ) {
+		fprintf(out,"{\"threads\":%u,\"wall_s\":%.3f,\"first_result_s\":%.3f,\"phases\":[",
+			nthreads,wall,first_result);
+		for ( size_t px=0; px < phases.size(); ++px ) {
+			const s_phase& ph = phases[px];
+
+			fprintf(out,"%s{\"name\":\"%s\",\"s\":%.3f",px ? "," : "",ph.name.c_str(),ph.secs);
+			for ( unsigned cx=0; cx < ncounters; ++cx )
+				if ( ph.counters[cx] )
+					fprintf(out,",\"%s\":%llu",counter_names[cx],(unsigned long long)ph.counters[cx]);
+			fputc('}',out);
+		}
+		fputs("],\"counters\":{",out);
+		for ( unsigned cx=0; cx < ncounters; ++cx )
+			fprintf(out,"%s\"%s\":%llu",cx ? "," : "",counter_names[cx],(unsigned long long)sums[cx]);
+		fprintf(out,"},\"eliminated\":{\"size\":%llu,\"fingerprint\":%llu,\"probe\":%llu,\"content\":%llu},\"peaks\":{",
+			(unsigned long long)by_size,(unsigned long long)by_fprint,
+			(unsigned long long)by_probe,(unsigned long long)by_content);
+		for ( unsigned px=0; px < npeaks; ++px )
+			fprintf(out,"%s\"%s\":%llu",px ? "," : "",peak_names[px],(unsigned long long)peak(Peak(px)));
+		fprintf(out,"},\"slots\":%u}\n",std::min(nslots.load(),max_slots));
+		fflush(out);
+		return;
+	}
+
+	fprintf(out,"Stats: %u threads, %.3f s, first set after %.3f s\n",nthreads,wall,first_result);
+	fprintf(out,"  %-12s %9s %10s %9s %9s %10s\n","Phase","Seconds","MB read","Files","Stats","Lock ms");
+	for ( auto& ph : phases )
+		fprintf(out,"  %-12s %9.3f %10.1f %9llu %9llu %10.1f\n",
+			ph.name.c_str(),ph.secs,
+			of(ph,Metric::BytesRead) / 1048576.0,
+			(unsigned long long)of(ph,Metric::FilesRead),
+			(unsigned long long)of(ph,Metric::StatCalls),
+			(of(ph,Metric::NamesWaitNs) + of(ph,Metric::FilesWaitNs)) / 1e6);
+	fprintf(out,"  Traversal: %llu dirs, %llu files, %llu links, %llu pruned, %llu syscalls (%llu stat)\n",
+		(unsigned long long)sum(Metric::Dirs),
+		(unsigned long long)files,
+		(unsigned long long)sum(Metric::Links),
+		(unsigned long long)sum(Metric::Pruned),
+		(unsigned long long)(sum(Metric::OpenCalls) + sum(Metric::GetdentsCalls)
+			+ sum(Metric::StatCalls) + sum(Metric::CloseCalls)),
+		(unsigned long long)sum(Metric::StatCalls));
+	if ( sum(Metric::RegisterNs) > 0 )
+		fprintf(out,"  Registration: %.3f s over all threads\n",sum(Metric::RegisterNs) / 1e9);
+	fprintf(out,"  Lock waits: names %llu (%.1f ms), files %llu (%.1f ms)\n",
+		(unsigned long long)sum(Metric::NamesWaits),sum(Metric::NamesWaitNs) / 1e6,
+		(unsigned long long)sum(Metric::FilesWaits),sum(Metric::FilesWaitNs) / 1e6);
+	fprintf(out,"  Reads: %llu files, %.1f MB; %llu fingerprints, %llu probes, %llu hashes, %llu compares\n",
+		(unsigned long long)sum(Metric::FilesRead),
+		sum(Metric::BytesRead) / 1048576.0,
+		(unsigned long long)sum(Metric::Fingerprints),
+		(unsigned long long)sum(Metric::Probes),
+		(unsigned long long)sum(Metric::Hashes),
+		(unsigned long long)sum(Metric::Compares));
+	fprintf(out,"  Eliminated: %llu by size, %llu by fingerprint, %llu by probe, %llu by content; %llu duplicates\n",
+		(unsigned long long)by_size,(unsigned long long)by_fprint,(unsigned long long)by_probe,
+		(unsigned long long)by_content,(unsigned long long)sum(Metric::DupFiles));
+	fprintf(out,"  Output: %.1f MB in %.3f s\n",
+		sum(Metric::OutputBytes) / 1048576.0,sum(Metric::OutputNs) / 1e9);
+	fprintf(out,"  Peak queues: dirs %llu, reads %llu, output %llu\n",
+		(unsigned long long)peak(Peak::DirQueue),
+		(unsigned long long)peak(Peak::ReadQueue),
+		(unsigned long long)peak(Peak::OutputQueue));
+	fflush(out);
+}
+
+// End metrics.cpp
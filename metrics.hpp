@@ -0,0 +1,158 @@
+//////////////////////////////////////////////////////////////////////
+// metrics.hpp -- Run counters, timers and the --stats report
+// Date: Sun Oct 18 22:10:05 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+enum class Metric : unsigned {
+	Dirs,			// Directories read
+	Files,			// Regular files registered
+	Links,			// Further names of registered files
+	Pruned,			// Entries skipped by --exclude, --max-depth..
+	OpenCalls,		// Directory open, openat
+	GetdentsCalls,		// getdents64, readdir
+	StatCalls,		// statx, fstatat
+	CloseCalls,
+	RegisterNs,		// In GlobalFiles::add (with --stats)
+	NamesWaits,		// Name table locks that had to wait
+	NamesWaitNs,
+	FilesWaits,		// File table locks that had to wait
+	FilesWaitNs,
+	FilesRead,		// Files opened for reading
+	BytesRead,
+	FprintBytes,		// .. for fingerprints
+	Fingerprints,		// First 1k fingerprints read
+	Hashes,			// Whole files hashed
+	Compares,		// Groups byte compared
+	Probes,			// Files read by --probe stages
+	SizeCandidates,		// Files sharing a size with another
+	FprintCandidates,	// .. and a fingerprint
+	ProbeCandidates,	// .. and probes
+	VerifyBytes,		// Bytes in the candidates to verify
+	VerifiedBytes,		// .. hashed or compared so far
+	DupFiles,		// Files in duplicate sets
+	OutputNs,		// Writer thread formatting and writing
+	OutputBytes,
+	Count
+};
+
+enum class Peak : unsigned {
+	DirQueue,		// Directories waiting to be read
+	ReadQueue,		// Fingerprint or verify work queued
+	OutputQueue,		// Sets waiting for the writer thread
+	Count
+};
+
+//////////////////////////////////////////////////////////////////////
+// Each thread counts into a slot of its own, so that counting takes
+// neither a lock nor a shared cache line. The slots are summed when
+// a phase ends and for the report. Threads beyond max_slots share
+// the last slot, which the atomic adds keep correct.
+//////////////////////////////////////////////////////////////////////
+
+class Metrics {
+	typedef std::chrono::steady_clock clock;
+
+	static const unsigned ncounters = unsigned(Metric::Count);
+	static const unsigned npeaks = unsigned(Peak::Count);
+	static const unsigned max_slots = 1024;
+
+	struct alignas(64) s_slot {
+		std::atomic<uint64_t>	counters[ncounters];
+		std::atomic<uint64_t>	peaks[npeaks];
+	};
+
+	struct s_phase {
+		std::string		name;
+		double			secs;
+		std::vector<uint64_t>	counters;	// During the phase
+	};
+
+	s_slot			slots[max_slots];
+	std::atomic<unsigned>	nslots;
+	std::mutex		mutex;		// Phases
+	std::vector<s_phase>	phases;
+	std::string		current;	// Phase under way
+	std::vector<uint64_t>	last;		// Totals when the last phase ended
+	clock::time_point	t_start;	// Start of the run
+	clock::time_point	t0;		// End of the last phase
+
+	s_slot& slot();
+	std::vector<uint64_t> totals();
+
+public:	bool			timing = false;	// Time hot paths (--stats)
+
+	// The run so far, for progress reports
+	struct s_snapshot {
+		std::string		phase;		// Under way
+		double			elapsed;	// Since the start
+		double			phase_secs;	// .. of this phase
+		std::vector<uint64_t>	totals;
+		std::vector<uint64_t>	in_phase;	// Counted in this phase
+
+		uint64_t operator[](Metric metric) const { return totals[unsigned(metric)]; }
+		uint64_t phase_count(Metric metric) const { return in_phase[unsigned(metric)]; }
+	};
+
+	Metrics();
+	static const char *name(Metric metric);
+	static const char *name(Peak peak);
+	static bool parse(const char *name,bool& json);
+
+	void add(Metric metric,uint64_t n=1) {
+		slot().counters[unsigned(metric)].fetch_add(n,std::memory_order_relaxed);
+	}
+	void peak(Peak peak,uint64_t n) {
+		std::atomic<uint64_t>& p = slot().peaks[unsigned(peak)];
+
+		if ( n > p.load(std::memory_order_relaxed) )
+			p.store(n,std::memory_order_relaxed);
+	}
+	uint64_t total(Metric metric);
+	uint64_t peak(Peak peak);
+	static uint64_t ns_since(clock::time_point t) {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t).count();
+	}
+
+	void start(clock::time_point t,const char *first);
+	double phase(const char *name,const char *next=nullptr);
+	s_snapshot snapshot();
+	void report(FILE *out,bool json,unsigned nthreads,double first_result);
+};
+
+extern Metrics metrics;
+
+//////////////////////////////////////////////////////////////////////
+// Take mutex, counting the time spent waiting when it was held by
+// another thread. For use with std::adopt_lock:
+//
+//	std::lock_guard<std::mutex> lock(timed_lock(m,..),std::adopt_lock);
+//////////////////////////////////////////////////////////////////////
+
+inline std::mutex&
+timed_lock(std::mutex& mutex,Metric waits,Metric wait_ns) {
+
+	if ( !mutex.try_lock() ) {
+		const auto t = std::chrono::steady_clock::now();
+
+		mutex.lock();
+		metrics.add(wait_ns,Metrics::ns_since(t));
+		metrics.add(waits);
+	}
+	return mutex;
+}
+
+#endif // METRICS_HPP
+
+// End metrics.hpp
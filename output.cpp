@@ -0,0 +1,207 @@
+//////////////////////////////////////////////////////////////////////
+// output.cpp -- Duplicate set output formats and writer thread
+// Date: Sun Oct 18 12:14:50 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "output.hpp"
+#include "metrics.hpp"
+
+static const char binary_magic[8] = { 'D','E','D','U','P','D','S','1' };
+
+bool
+DupWriter::parse(const char *name,Format& format) {
+	static const struct {
+		const char	*name;
+		Format		format;
+	} formats[] = {
+		{ "text",	Format::Text },
+		{ "nul",	Format::Nul },
+		{ "jsonl",	Format::Jsonl },
+		{ "binary",	Format::Binary },
+	};
+
+	for ( auto& f : formats )
+		if ( !strcmp(f.name,name) ) {
+			format = f.format;
+			return true;
+		}
+	return false;
+}
+
+void
+DupWriter::start(FILE *out,Format format,clock::time_point t0) {
+
+	this->out = out;
+	this->format = format;
+	this->t0 = t0;
+
+	if ( format == Format::Text )
+		fputs("LIST OF DUPLICATE FILES:\n",out);
+	else if ( format == Format::Binary )
+		fwrite(binary_magic,sizeof binary_magic,1,out);
+	fflush(out);
+
+	thread = std::thread(&DupWriter::run,this);
+}
+
+void
+DupWriter::emit(s_dupset&& set) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	pending.push_back(std::move(set));
+	metrics.peak(Peak::OutputQueue,pending.size());
+	cv.notify_one();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Write out any remaining sets and stop the writer thread
+//////////////////////////////////////////////////////////////////////
+
+void
+DupWriter::finish() {
+
+	if ( !thread.joinable() )
+		return;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+
+		closing = true;
+		cv.notify_one();
+	}
+	thread.join();
+}
+
+//////////////////////////////////////////////////////////////////////
+// Append a string as a JSON string literal. Bytes that are not
+// control characters are passed through as is.
+//////////////////////////////////////////////////////////////////////
+
+static void
+json_string(std::string& buf,const std::string& s) {
+	static const char hex[] = "0123456789abcdef";
+
+	buf += '"';
+	for ( unsigned char ch : s ) {
+		switch ( ch ) {
+		case '"':	buf += "\\\""; break;
+		case '\\':	buf += "\\\\"; break;
+		case '\n':	buf += "\\n"; break;
+		case '\t':	buf += "\\t"; break;
+		default:
+			if ( ch < 0x20 ) {
+				buf += "\\u00";
+				buf += hex[ch >> 4];
+				buf += hex[ch & 0x0F];
+			} else	buf += char(ch);
+		}
+	}
+	buf += '"';
+}
+
+template<typename T>
+static void
+put(std::string& buf,T v) {
+	buf.append((const char *)&v,sizeof v);
+}
+
+static void
+put_string(std::string& buf,const std::string& s) {
+	put(buf,uint32_t(s.size()));
+	buf += s;
+}
+
+void
+DupWriter::format_set(const s_dupset& set,std::string& buf) {
+
+	switch ( format ) {
+	case Format::Text:
+		buf += "  Duplicate set " + std::to_string(set.id)
+			+ ", " + std::to_string(set.size) + " bytes:\n";
+		for ( auto& file : set.files ) {
+			buf += "    File " + file.path + '\n';
+			for ( auto& link : file.links )
+				buf += "      ln " + link + '\n';
+		}
+		break;
+	case Format::Nul:
+		for ( auto& file : set.files ) {
+			buf += file.path;
+			buf += '\0';
+		}
+		buf += '\0';
+		break;
+	case Format::Jsonl:
+		buf += "{\"set\":" + std::to_string(set.id)
+			+ ",\"size\":" + std::to_string(set.size)
+			+ ",\"files\":[";
+		for ( size_t fx=0; fx < set.files.size(); ++fx ) {
+			auto& file = set.files[fx];
+
+			if ( fx > 0 )
+				buf += ',';
+			buf += "{\"path\":";
+			json_string(buf,file.path);
+			if ( !file.links.empty() ) {
+				buf += ",\"links\":[";
+				for ( size_t lx=0; lx < file.links.size(); ++lx ) {
+					if ( lx > 0 )
+						buf += ',';
+					json_string(buf,file.links[lx]);
+				}
+				buf += ']';
+			}
+			buf += '}';
+		}
+		buf += "]}\n";
+		break;
+	case Format::Binary:
+		put(buf,uint64_t(set.id));
+		put(buf,uint64_t(set.size));
+		put(buf,uint32_t(set.files.size()));
+		for ( auto& file : set.files ) {
+			put_string(buf,file.path);
+			put(buf,uint32_t(file.links.size()));
+			for ( auto& link : file.links )
+				put_string(buf,link);
+		}
+		break;
+	}
+}
+
+void
+DupWriter::run() {
+	std::deque<s_dupset> sets;
+	std::string buf;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			cv.wait(lock,[this]() { return closing || !pending.empty(); });
+			if ( pending.empty() )
+				break;		// Closing, and all written
+			sets.swap(pending);
+		}
+
+		const auto t = clock::now();
+
+		buf.clear();
+		for ( auto& set : sets )
+			format_set(set,buf);
+
+		fwrite(buf.data(),buf.size(),1,out);
+		fflush(out);		// Caught up: let the consumer see it
+		metrics.add(Metric::OutputNs,Metrics::ns_since(t));
+		metrics.add(Metric::OutputBytes,buf.size());
+
+		if ( first_us.load() < 0 )
+			first_us.store(std::chrono::duration_cast<std::chrono::microseconds>(
+				clock::now() - t0).count());
+		nsets += sets.size();
+		sets.clear();
+	}
+}
+
+// End output.cpp
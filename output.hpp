@@ -0,0 +1,75 @@
+//////////////////////////////////////////////////////////////////////
+// output.hpp -- Duplicate set output formats and writer thread
+// Date: Sun Oct 18 12:06:31 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef OUTPUT_HPP
+#define OUTPUT_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+struct s_dupfile {
+	std::string			path;
+	std::vector<std::string>	links;	// Other names of the same inode
+};
+
+struct s_dupset {
+	uint64_t			id;	// Duplicate set number
+	uint64_t			size;	// Size of each file
+	std::vector<s_dupfile>		files;
+};
+
+enum class Format {
+	Text,		// LIST OF DUPLICATE FILES, for people
+	Nul,		// Pathnames ending in NUL, a set ending in an empty one
+	Jsonl,		// One JSON object per set
+	Binary		// Length prefixed records (see README.md)
+};
+
+//////////////////////////////////////////////////////////////////////
+// Duplicate sets are handed to emit() by the verifying threads as
+// soon as they are confirmed. A writer thread formats them and
+// writes them out, flushing whenever it has caught up, so that a
+// consumer can start on the first sets while the rest are still
+// being verified.
+//////////////////////////////////////////////////////////////////////
+
+class DupWriter {
+	typedef std::chrono::steady_clock clock;
+
+	FILE			*out = nullptr;
+	Format			format = Format::Text;
+	std::mutex		mutex;
+	std::condition_variable	cv;
+	std::deque<s_dupset>	pending;
+	bool			closing = false;
+	std::thread		thread;
+	clock::time_point	t0;		// Program start
+	std::atomic<int64_t>	first_us;	// Time to first set, else -1
+	std::atomic<uint64_t>	nsets;
+
+	void run();
+	void format_set(const s_dupset& set,std::string& buf);
+
+public:	DupWriter() : first_us(-1), nsets(0) {}
+	static bool parse(const char *name,Format& format);
+	void start(FILE *out,Format format,clock::time_point t0);
+	void emit(s_dupset&& set);
+	void finish();
+	uint64_t sets() { return nsets.load(); }
+	double first_result() { return first_us.load() / 1e6; }
+};
+
+#endif // OUTPUT_HPP
+
+// End output.hpp
@@ -0,0 +1,127 @@
+//////////////////////////////////////////////////////////////////////
+// pipeline.hpp -- Collision indexes and worker parking for the
+//                 overlapped scan, fingerprint and verify stages
+// Date: Mon Oct 19 14:05:52 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "system.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Files by (size, key), sharded. A file passes on to the next stage
+// only once another file shares its size and key: add() returns no
+// files while a key is alone, both files when a second arrives, and
+// from then on each new file by itself.
+//////////////////////////////////////////////////////////////////////
+
+class Collisions {
+	static const unsigned nshards = 64;
+
+	struct s_key {
+		off_t		size;
+		uint64_t	key;
+
+		bool operator==(const s_key& other) const {
+			return size == other.size && key == other.key;
+		}
+	};
+	struct s_hash {
+		size_t operator()(const s_key& k) const {
+			const uint64_t h = (uint64_t(k.size) * 0x9E3779B97F4A7C15ULL) ^ k.key;
+
+			return h ^ (h >> 29);
+		}
+	};
+	struct s_shard {
+		std::mutex	mutex;
+		std::unordered_map<s_key,Fileno_t,s_hash> first; // 0 once passed on
+	};
+
+	s_shard		shards[nshards];
+
+public:	unsigned add(off_t size,uint64_t key,Fileno_t file,Fileno_t out[2]) {
+		const s_key k = { size, key };
+		s_shard& shard = shards[(s_hash()(k) >> 7) % nshards];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto ins = shard.first.emplace(k,file);
+
+		if ( ins.second )
+			return 0;		// Alone so far
+
+		Fileno_t& first = ins.first->second;
+
+		if ( first == 0 ) {
+			out[0] = file;
+			return 1;
+		}
+		out[0] = first;
+		out[1] = file;
+		first = 0;
+		return 2;
+	}
+};
+
+//////////////////////////////////////////////////////////////////////
+// Parks workers that share one thread budget over several queues.
+// Each item pushed to any of them goes through push(), and is
+// counted off by done() once it has been handled (after any items
+// it produced were pushed). A worker reads state() before trying the
+// queues, and if none gave it work, wait(state) sleeps until
+// something was pushed or done since. It returns false when no work
+// is left anywhere.
+//////////////////////////////////////////////////////////////////////
+
+class Pipeline {
+	std::mutex		mutex;
+	std::condition_variable	cv;
+	size_t			pending = 0;	// Pushed, not yet done()
+	uint64_t		seq = 0;	// Bumped by push() and done()
+
+public:	// Count an item, then wake a worker once enqueue() has queued it
+	template<typename F> void push(F enqueue) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			++pending;
+		}
+		enqueue();
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		++seq;
+		cv.notify_one();
+	}
+
+	void done() {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		++seq;
+		if ( --pending == 0 )
+			cv.notify_all();
+		else	cv.notify_one();
+	}
+
+	uint64_t state() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return seq;
+	}
+
+	bool wait(uint64_t seen) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		cv.wait(lock,[&]() { return seq != seen || pending == 0; });
+		return pending != 0;
+	}
+};
+
+#endif // PIPELINE_HPP
+
+// End pipeline.hpp
@@ -0,0 +1,252 @@
+//////////////////////////////////////////////////////////////////////
+// progress.cpp -- Progress ticker and Unix socket snapshots
+// Date: Sun Oct 18 23:14:51 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+
+#include "progress.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// Start the ticker (interval seconds, 0 for none) and the socket
+// (path, nullptr for none). Returns 0, or errno when the socket
+// cannot be set up. A stale socket left at path is replaced.
+//////////////////////////////////////////////////////////////////////
+
+int
+Progress::start(unsigned interval,const char *path) {
+	this->interval = interval;
+
+	if ( path ) {
+		struct sockaddr_un addr;
+		struct stat sbuf;
+
+		if ( strlen(path) >= sizeof addr.sun_path )
+			return ENAMETOOLONG;
+		if ( lstat(path,&sbuf) == 0 && S_ISSOCK(sbuf.st_mode) )
+			::unlink(path);
+
+		memset(&addr,0,sizeof addr);
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path,path);
+
+		listen_fd = ::socket(AF_UNIX,SOCK_STREAM|SOCK_CLOEXEC,0);
+		if ( listen_fd == -1 )
+			return errno;
+		if ( ::bind(listen_fd,(struct sockaddr *)&addr,sizeof addr) == -1
+		  || ::listen(listen_fd,8) == -1 ) {
+			int rc = errno;
+
+			::close(listen_fd);
+			listen_fd = -1;
+			return rc;
+		}
+		this->path = path;
+	}
+
+	if ( interval == 0 && listen_fd < 0 )
+		return 0;
+	if ( ::pipe(wake) == -1 )
+		return errno;
+	thread = std::thread(&Progress::run,this);
+	return 0;
+}
+
+void
+Progress::stop() {
+
+	if ( thread.joinable() ) {
+		while ( ::write(wake[1],"",1) == -1 && errno == EINTR )
+			continue;
+		thread.join();
+	}
+	for ( auto& fd : wake )
+		if ( fd >= 0 ) {
+			::close(fd);
+			fd = -1;
+		}
+	if ( listen_fd >= 0 ) {
+		::close(listen_fd);
+		::unlink(path.c_str());
+		listen_fd = -1;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Bytes/s since the previous sample, over at least half a second
+//////////////////////////////////////////////////////////////////////
+
+void
+Progress::sample(const Metrics::s_snapshot& snap) {
+	const uint64_t bytes = snap[Metric::BytesRead];
+
+	if ( snap.elapsed - last_secs < 0.5 && last_secs > 0 )
+		return;
+	rate = snap.elapsed > last_secs ? (bytes - last_bytes) / (snap.elapsed - last_secs) : 0;
+	last_secs = snap.elapsed;
+	last_bytes = bytes;
+}
+
+//////////////////////////////////////////////////////////////////////
+// How far the phase has got: fingerprints by files done, verify by
+// candidate bytes hashed or compared, and the pipeline by whichever
+// of the two is further behind. The directory walk cannot know what
+// is left, so while the pipeline is still walking, its totals only
+// grow: the estimate is then a lower bound.
+//////////////////////////////////////////////////////////////////////
+
+Progress::s_eta
+Progress::eta(const Metrics::s_snapshot& snap) {
+	s_eta e = { -1, -1 };
+	double total = 0, done = 0, in_phase = 0;
+
+	// The fingerprint or verify stage's files or bytes so far
+	auto stage = [&](Metric of,Metric count) {
+		total = snap[of];
+		done = snap[count];
+		in_phase = snap.phase_count(count);
+	};
+
+	if ( snap.phase == "fingerprint" ) {
+		stage(Metric::SizeCandidates,Metric::Fingerprints);
+	} else if ( snap.phase == "verify" ) {
+		stage(Metric::VerifyBytes,Metric::VerifiedBytes);
+	} else if ( snap.phase == "pipeline" ) {
+		const double fprinted = snap[Metric::SizeCandidates] > 0
+			? double(snap[Metric::Fingerprints]) / snap[Metric::SizeCandidates] : 1;
+		const double verified = snap[Metric::VerifyBytes] > 0
+			? double(snap[Metric::VerifiedBytes]) / snap[Metric::VerifyBytes] : 1;
+
+		if ( fprinted <= verified )
+			stage(Metric::SizeCandidates,Metric::Fingerprints);
+		else	stage(Metric::VerifyBytes,Metric::VerifiedBytes);
+	}
+	if ( total <= 0 )
+		return e;
+
+	e.done = std::min(1.0,done / total);
+	if ( in_phase > 0 )
+		e.secs = snap.phase_secs * (total - std::min(done,total)) / in_phase;
+	return e;
+}
+
+std::string
+Progress::line(const Metrics::s_snapshot& snap) {
+	const s_eta e = eta(snap);
+	const double avg = snap.elapsed > 0 ? snap[Metric::BytesRead] / snap.elapsed : 0;
+	char buf[512];
+	int n;
+
+	n = snprintf(buf,sizeof buf,"[%s %.0fs] %llu dirs, %llu files, candidates %llu/%llu/%llu, %llu dups, "
+		"%.1f MB read, %.1f MB/s (avg %.1f)",
+		snap.phase.c_str(),snap.elapsed,
+		(unsigned long long)snap[Metric::Dirs],
+		(unsigned long long)snap[Metric::Files],
+		(unsigned long long)snap[Metric::SizeCandidates],
+		(unsigned long long)snap[Metric::FprintCandidates],
+		(unsigned long long)snap[Metric::ProbeCandidates],
+		(unsigned long long)snap[Metric::DupFiles],
+		snap[Metric::BytesRead] / 1048576.0,
+		rate / 1048576.0,avg / 1048576.0);
+	if ( e.done >= 0 && n < int(sizeof buf) )
+		n += snprintf(buf + n,sizeof buf - n,", %.0f%%",e.done * 100);
+	if ( e.secs >= 0 && n < int(sizeof buf) ) {
+		const unsigned long s = e.secs + 0.5;
+
+		snprintf(buf + n,sizeof buf - n," ETA %lu:%02lu:%02lu",s / 3600,s / 60 % 60,s % 60);
+	}
+	return buf;
+}
+
+std::string
+Progress::json(const Metrics::s_snapshot& snap) {
+	const s_eta e = eta(snap);
+	char buf[1024];
+
+	snprintf(buf,sizeof buf,"{\"phase\":\"%s\",\"elapsed_s\":%.3f,\"phase_s\":%.3f,"
+		"\"dirs\":%llu,\"files\":%llu,\"size_candidates\":%llu,\"fprint_candidates\":%llu,"
+		"\"probe_candidates\":%llu,\"dup_files\":%llu,\"fingerprints\":%llu,\"hashes\":%llu,"
+		"\"bytes_fingerprinted\":%llu,\"bytes_verified\":%llu,\"bytes_read\":%llu,"
+		"\"rate_bps\":%.0f,\"avg_bps\":%.0f,\"done\":%.3f,\"eta_s\":%.0f}\n",
+		snap.phase.c_str(),snap.elapsed,snap.phase_secs,
+		(unsigned long long)snap[Metric::Dirs],
+		(unsigned long long)snap[Metric::Files],
+		(unsigned long long)snap[Metric::SizeCandidates],
+		(unsigned long long)snap[Metric::FprintCandidates],
+		(unsigned long long)snap[Metric::ProbeCandidates],
+		(unsigned long long)snap[Metric::DupFiles],
+		(unsigned long long)snap[Metric::Fingerprints],
+		(unsigned long long)snap[Metric::Hashes],
+		(unsigned long long)snap[Metric::FprintBytes],
+		(unsigned long long)snap[Metric::VerifiedBytes],
+		(unsigned long long)snap[Metric::BytesRead],
+		rate,
+		snap.elapsed > 0 ? snap[Metric::BytesRead] / snap.elapsed : 0.0,
+		e.done,e.secs);
+	return buf;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Tick, and answer connections, until stop() writes to wake
+//////////////////////////////////////////////////////////////////////
+
+void
+Progress::run() {
+	struct pollfd fds[2];
+	auto next = clock::now() + std::chrono::seconds(interval);
+
+	fds[0].fd = wake[0];
+	fds[0].events = POLLIN;
+	fds[1].fd = listen_fd;
+	fds[1].events = POLLIN;
+	fds[1].revents = 0;		// Not polled without a socket
+
+	for (;;) {
+		int timeout = -1;
+
+		if ( interval > 0 )
+			timeout = std::max(0L,long(std::chrono::duration_cast<std::chrono::milliseconds>(
+				next - clock::now()).count()));
+
+		int rc = ::poll(fds,listen_fd >= 0 ? 2 : 1,timeout);
+
+		if ( rc == -1 && errno != EINTR )
+			break;
+		if ( rc > 0 && (fds[0].revents & POLLIN) )
+			break;		// stop()
+
+		if ( rc > 0 && (fds[1].revents & POLLIN) ) {
+			int fd = ::accept4(listen_fd,nullptr,nullptr,SOCK_CLOEXEC);
+
+			if ( fd >= 0 ) {
+				Metrics::s_snapshot snap = metrics.snapshot();
+
+				sample(snap);
+
+				const std::string text = json(snap);
+
+				::send(fd,text.data(),text.size(),MSG_NOSIGNAL|MSG_DONTWAIT);
+				::close(fd);
+			}
+		}
+
+		if ( interval > 0 && clock::now() >= next ) {
+			Metrics::s_snapshot snap = metrics.snapshot();
+
+			sample(snap);
+			fprintf(stderr,"%s\n",line(snap).c_str());
+			next += std::chrono::seconds(interval);
+		}
+	}
+}
+
+// End progress.cpp
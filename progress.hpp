@@ -0,0 +1,59 @@
+//////////////////////////////////////////////////////////////////////
+// progress.hpp -- Progress ticker and Unix socket snapshots
+// Date: Sun Oct 18 23:02:26 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef PROGRESS_HPP
+#define PROGRESS_HPP
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <thread>
+
+#include "metrics.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// A thread that writes a one line summary of the run to stderr every
+// interval seconds (when interval > 0), and answers each connection
+// to a Unix domain socket (when given a path) with a JSON snapshot
+// of the run, then closes it:
+//
+//	socat - UNIX-CONNECT:/tmp/deduper.sock
+//
+// Both are built from Metrics::snapshot(), which sums the per-thread
+// counters, so the workers are not disturbed.
+//////////////////////////////////////////////////////////////////////
+
+class Progress {
+	typedef std::chrono::steady_clock clock;
+
+	unsigned		interval = 0;	// Seconds between lines
+	std::string		path;		// Socket
+	int			listen_fd = -1;
+	int			wake[2] = { -1, -1 };	// stop() writes here
+	std::thread		thread;
+	double			last_secs = 0;	// Previous rate sample
+	uint64_t		last_bytes = 0;
+	double			rate = 0;	// Bytes/s since then
+
+	struct s_eta {
+		double		done;		// Fraction of the phase, else -1
+		double		secs;		// Left, else -1
+	};
+
+	void run();
+	void sample(const Metrics::s_snapshot& snap);
+	s_eta eta(const Metrics::s_snapshot& snap);
+	std::string line(const Metrics::s_snapshot& snap);
+	std::string json(const Metrics::s_snapshot& snap);
+
+public:	~Progress() { stop(); }
+	int start(unsigned interval,const char *path);
+	void stop();
+};
+
+#endif // PROGRESS_HPP
+
+// End progress.hpp
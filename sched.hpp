@@ -0,0 +1,274 @@
+//////////////////////////////////////////////////////////////////////
+// sched.hpp -- Work-stealing and per-device schedulers
+// Date: Sat Oct 17 16:22:47 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef SCHED_HPP
+#define SCHED_HPP
+
+#include <stdint.h>
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <map>
+#include <functional>
+
+//////////////////////////////////////////////////////////////////////
+// Each worker thread owns a deque. A worker pushes and pops its own
+// work at the back (LIFO, so a directory tree is walked depth first)
+// and steals from the front of other deques (FIFO, taking the oldest
+// and usually largest pieces of work).
+//
+// Workers with nothing to do park on a condition variable. Every
+// item taken by pop() must be followed by a call to done(), after
+// any new work it produced has been pushed. When the count of
+// unfinished items reaches zero, all workers are woken and pop()
+// returns false.
+//////////////////////////////////////////////////////////////////////
+
+template<typename T>
+class WorkStealer {
+	struct s_deque {
+		std::mutex	mutex;
+		std::deque<T>	items;
+	};
+	std::vector<std::unique_ptr<s_deque>> deques;
+	std::atomic<size_t>	queued;		// Items in all deques
+	std::atomic<size_t>	pending;	// Items pushed, not yet done()
+	std::atomic<unsigned>	parked;		// Workers waiting for work
+	std::mutex		park_mutex;
+	std::condition_variable	park_cv;
+
+	bool take(unsigned thx,T& item) {
+		const unsigned n = deques.size();
+
+		{
+			s_deque& own = *deques[thx];
+			std::lock_guard<std::mutex> lock(own.mutex);
+
+			if ( !own.items.empty() ) {
+				item = std::move(own.items.back());
+				own.items.pop_back();
+				--queued;
+				return true;
+			}
+		}
+
+		for ( unsigned vx=1; vx < n; ++vx ) {
+			s_deque& victim = *deques[(thx + vx) % n];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+
+			if ( !victim.items.empty() ) {
+				item = std::move(victim.items.front());
+				victim.items.pop_front();
+				--queued;
+				return true;
+			}
+		}
+		return false;
+	}
+
+public:	WorkStealer(unsigned nthreads=1) : queued(0), pending(0), parked(0) {
+		resize(nthreads);
+	}
+
+	// Set the number of workers (before any work is pushed)
+	void resize(unsigned nthreads) {
+		while ( deques.size() < nthreads )
+			deques.emplace_back(new s_deque);
+	}
+
+	void push(unsigned thx,const T& item) {
+		s_deque& own = *deques[thx % deques.size()];
+
+		++pending;
+		{
+			std::lock_guard<std::mutex> lock(own.mutex);
+			own.items.push_back(item);
+		}
+		++queued;
+		if ( parked.load() > 0 ) {
+			std::lock_guard<std::mutex> lock(park_mutex);
+			park_cv.notify_one();
+		}
+	}
+
+	bool pop(unsigned thx,T& item) {
+		for (;;) {
+			if ( take(thx,item) )
+				return true;
+
+			std::unique_lock<std::mutex> lock(park_mutex);
+
+			++parked;
+			park_cv.wait(lock,[this]() {
+				return queued.load() > 0 || pending.load() == 0;
+			});
+			--parked;
+			if ( pending.load() == 0 )
+				return false;
+		}
+	}
+
+	// Take an item if there is one, without waiting
+	bool try_pop(unsigned thx,T& item) {
+		return take(thx,item);
+	}
+
+	void done() {
+		if ( --pending == 0 ) {
+			std::lock_guard<std::mutex> lock(park_mutex);
+			park_cv.notify_all();
+		}
+	}
+
+	size_t size() { return queued.load(); }
+};
+
+//////////////////////////////////////////////////////////////////////
+// Per-device queues for reading files. Each item is queued on a
+// device with a key, a physical offset or inode number, and a device
+// admits at most limit(dev) workers at a time (0 for no limit). A
+// worker takes from the next device with a free slot, round robin,
+// the first item at or past the last key taken there: a one way
+// sweep over the disk (C-SCAN). Urgent items go ahead of the sweep,
+// first in first out.
+//
+// As with WorkStealer, each item taken by pop() or try_pop() must be
+// followed by a call to done(dev), after any new work it produced has
+// been pushed. pop() returns false once no work is left; try_pop()
+// does not wait, so that a worker with reads in flight can go back
+// to them.
+//////////////////////////////////////////////////////////////////////
+
+template<typename T>
+class DeviceScheduler {
+	struct s_device {
+		unsigned		limit = 0;	// Workers at once, 0 for any
+		unsigned		active = 0;	// Workers on it now
+		uint64_t		cursor = 0;	// Key last taken
+		std::deque<T>		urgent;
+		std::multimap<uint64_t,T> items;
+
+		bool ready() const {
+			return (limit == 0 || active < limit)
+				&& (!urgent.empty() || !items.empty());
+		}
+	};
+	std::function<unsigned(uint64_t)> limit;
+	std::map<uint64_t,s_device>	devices;
+	uint64_t		last = 0;	// Device last served
+	size_t			queued = 0;
+	size_t			pending = 0;	// Pushed, not yet done()
+	std::mutex		mutex;
+	std::condition_variable	cv;
+
+	s_device& device(uint64_t dev) {
+		auto it = devices.find(dev);
+
+		if ( it == devices.end() ) {
+			it = devices.emplace(dev,s_device()).first;
+			it->second.limit = limit ? limit(dev) : 0;
+		}
+		return it->second;
+	}
+
+	bool take(T& item,uint64_t& dev) {
+		auto it = devices.upper_bound(last);
+
+		for ( size_t dx=0; dx < devices.size(); ++dx, ++it ) {
+			if ( it == devices.end() )
+				it = devices.begin();
+
+			s_device& d = it->second;
+
+			if ( !d.ready() )
+				continue;
+
+			if ( !d.urgent.empty() ) {
+				item = std::move(d.urgent.front());
+				d.urgent.pop_front();
+			} else	{
+				auto ix = d.items.lower_bound(d.cursor);
+
+				if ( ix == d.items.end() )
+					ix = d.items.begin();	// Back to the start
+				d.cursor = ix->first;
+				item = std::move(ix->second);
+				d.items.erase(ix);
+			}
+			++d.active;
+			--queued;
+			dev = last = it->first;
+			return true;
+		}
+		return false;
+	}
+
+public:	DeviceScheduler(std::function<unsigned(uint64_t)> limit=nullptr) : limit(limit) {}
+
+	void push(uint64_t dev,uint64_t key,T&& item,bool urgent=false) {
+		std::lock_guard<std::mutex> lock(mutex);
+		s_device& d = device(dev);
+
+		if ( urgent )
+			d.urgent.push_back(std::move(item));
+		else	d.items.emplace(key,std::move(item));
+		++queued;
+		++pending;
+		cv.notify_one();
+	}
+
+	// Take an item from the next ready device, if there is one
+	bool try_pop(T& item,uint64_t& dev) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		return take(item,dev);
+	}
+
+	bool pop(T& item,uint64_t& dev) {
+		std::unique_lock<std::mutex> lock(mutex);
+
+		for (;;) {
+			if ( take(item,dev) )
+				return true;
+			if ( pending == 0 )
+				return false;
+			cv.wait(lock);
+		}
+	}
+
+	void done(uint64_t dev) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		--device(dev).active;
+		if ( --pending == 0 )
+			cv.notify_all();
+		else	cv.notify_one();
+	}
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return queued;
+	}
+	size_t ndevices() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return devices.size();
+	}
+	size_t nlimited() {
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t n = 0;
+
+		for ( auto& pair : devices )
+			n += pair.second.limit != 0;
+		return n;
+	}
+};
+
+#endif // SCHED_HPP
+
+// End sched.hpp
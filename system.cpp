@@ -12,38 +12,178 @@
 #include <string.h>
 #include <assert.h>
 
-#include <sstream>
-
 #include "system.hpp"
 #include "dir.hpp"
+#include "ioengine.hpp"
+#include "metrics.hpp"
+
+#include <algorithm>
+
+Names::s_shard::s_shard() {
+	for ( auto& chunk : index )
+		chunk.store(nullptr);
+}
+
+Names::s_shard::~s_shard() {
+	for ( auto& chunk : index )
+		delete[] chunk.load();
+	for ( auto arena : arenas )
+		delete[] arena;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Copy a name into the shard's arena (mutex held)
+//////////////////////////////////////////////////////////////////////
+
+const char *
+Names::s_shard::store(const char *name,size_t len) {
+	char *cp;
+
+	if ( len + 1 > arena_left ) {
+		size_t bytes = len + 1 > arena_size ? len + 1 : arena_size;
 
-extern Names names_pool;
+		arenas.push_back(new char[bytes]);
+		arena = arenas.back();
+		arena_left = bytes;
+	}
+	cp = arena;
+	memcpy(cp,name,len);
+	cp[len] = 0;
+	arena += len + 1;
+	arena_left -= len + 1;
+	return cp;
+}
 
 Name_t
 Names::name_register(const char *name) {
-	const std::string find_name(name);
-	std::lock_guard<std::mutex> lock(mutex);
-
-	auto it = names.find(find_name);
-	if ( it == names.end() ) {
-		Name_t id = allocate();
-		names.insert(std::pair<std::string,Name_t>(find_name,id));
-		auto i2 = names.find(find_name);
-		rev_names.insert(std::pair<Name_t,const char *>(id,i2->first.c_str()));
-		return id;
-	} else	{
+	const std::string_view find_name(name);
+	const size_t h = std::hash<std::string_view>()(find_name);
+	const unsigned shx = (h >> (sizeof h * 8 - shard_bits)) & (nshards - 1);
+	s_shard& shard = shards[shx];
+	std::lock_guard<std::mutex> lock(timed_lock(shard.mutex,Metric::NamesWaits,Metric::NamesWaitNs),std::adopt_lock);
+
+	auto it = shard.names.find(find_name);
+	if ( it != shard.names.end() )
 		return it->second;
+
+	const uint32_t ix = ++shard.count;	// Index 0 is unused: no Name_t is 0
+	const unsigned cx = ix >> chunk_bits;
+	const char **chunk = shard.index[cx].load();
+	const char *stored = shard.store(name,find_name.size());
+	Name_t id = (Name_t(ix) << shard_bits) | shx;
+
+	assert(cx < nchunks);
+	if ( !chunk ) {
+		chunk = new const char *[1u << chunk_bits];
+		shard.index[cx].store(chunk);
 	}
+	chunk[ix & ((1u << chunk_bits) - 1)] = stored;
+	shard.names.emplace(std::string_view(stored,find_name.size()),id);
+	++nnames;
+	return id;
 }
 
-std::string
+const char *
 Names::lookup(Name_t name_id) {
-	std::lock_guard<std::mutex> lock(mutex);
+	s_shard& shard = shards[name_id & (nshards - 1)];
+	const uint32_t ix = name_id >> shard_bits;
+
+	return shard.index[ix >> chunk_bits].load()[ix & ((1u << chunk_bits) - 1)];
+}
+
+DirTree::DirTree() : next(1) {
+	for ( auto& chunk : chunks )
+		chunk.store(nullptr);
+	chunks[0].store(new s_node[1u << chunk_bits]);
+	node(root).parent = root;
+	node(root).name = 0;
+}
+
+DirTree::~DirTree() {
+	for ( auto& chunk : chunks )
+		delete[] chunk.load();
+}
 
-	auto it = rev_names.find(name_id);
-	if ( it != rev_names.end() )
-		return std::string(it->second);
-	return "";
+Dirno_t
+DirTree::add(Dirno_t parent,Name_t name) {
+	const Dirno_t dir = next++;
+	const unsigned cx = dir >> chunk_bits;
+
+	assert(cx < nchunks);
+	if ( !chunks[cx].load() ) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if ( !chunks[cx].load() )
+			chunks[cx].store(new s_node[1u << chunk_bits]);
+	}
+
+	s_node& n = node(dir);
+
+	n.parent = parent;
+	n.name = name;
+	return dir;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Return the node for an absolute directory pathname, adding nodes
+// for any components not seen before by intern().
+//////////////////////////////////////////////////////////////////////
+
+Dirno_t
+DirTree::intern(const char *abspath) {
+	std::list<std::string> list = GlobalFiles::pathparse(abspath);
+	Dirno_t dir = root;
+
+	for ( auto& component : list ) {
+		Name_t name = name_pool.name_register(component.c_str());
+		uint64_t key = (uint64_t(dir) << 32) | name;
+		std::lock_guard<std::mutex> lock(intern_mutex);
+		auto it = interned.find(key);
+
+		if ( it != interned.end() )
+			dir = it->second;
+		else	dir = interned[key] = add(dir,name);
+	}
+	return dir;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Rebuild the pathname of a directory, or of a name within it
+//////////////////////////////////////////////////////////////////////
+
+std::string
+DirTree::pathname(Dirno_t dir,Name_t name) {
+	const char *comps[64];
+	std::vector<const char *> more;
+	unsigned ncomps = 0;
+	size_t len = 0;
+	std::string path;
+
+	auto push = [&](const char *comp) {
+		len += strlen(comp) + 1;
+		if ( ncomps < sizeof comps / sizeof comps[0] )
+			comps[ncomps++] = comp;
+		else	more.push_back(comp);
+	};
+
+	if ( name != 0 )
+		push(name_pool.lookup(name));
+	for ( ; dir != root; dir = node(dir).parent )
+		push(name_pool.lookup(node(dir).name));
+
+	if ( len == 0 )
+		return "/";
+
+	path.reserve(len);
+	for ( auto it = more.rbegin(); it != more.rend(); ++it ) {
+		path += '/';
+		path += *it;
+	}
+	while ( ncomps > 0 ) {
+		path += '/';
+		path += comps[--ncomps];
+	}
+	return path;
 }
 
 std::string
@@ -76,152 +216,367 @@ GlobalFiles::pathparse(const char *pathname) {
 	return list;
 }
 
-NameStr_t
-Names::add_names(std::list<std::string>& list_path) {
-	NameStr_t names_path;
-	Name_t id;
+unsigned GlobalFiles::compare_fds = 64;
 
-	for ( auto& component : list_path ) {
-		id = name_pool.name_register(component.c_str());
-		names_path += id;
-	}
-	return names_path;
+GlobalFiles::GlobalFiles(Uid<Fileno_t>& fpool) : nfiles(0), frozen(false), file_pool(fpool) {
+	for ( auto& chunk : chunks )
+		chunk.store(nullptr);
+}
+
+GlobalFiles::~GlobalFiles() {
+	for ( auto& chunk : chunks )
+		delete chunk.load();
 }
 
 Fileno_t
-GlobalFiles::add(const char *path) {
-	std::list<std::string> list = pathparse(abspath(path).c_str());
-	std::lock_guard<std::recursive_mutex> lock(mutex);
-	struct stat sinfo;
-	int rc;
-	extern Names name_pool;
+GlobalFiles::add(Dirno_t dir,const char *name,const struct stat& sinfo,bool *linked) {
+	const auto t0 = metrics.timing ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+	PathRef names_path;
 
-	rc = lstat(path,&sinfo);
-	assert(!rc);
+	names_path.dir = dir;
+	names_path.name = name_pool.name_register(name);
 
 	assert(S_ISREG(sinfo.st_mode));
 
-	auto& inomap = rmap[sinfo.st_dev];
+	s_inode_shard& ishard = inode_shards[inode_shard(sinfo.st_dev,sinfo.st_ino)];
+	std::unique_lock<std::mutex> ilock(timed_lock(ishard.mutex,Metric::FilesWaits,Metric::FilesWaitNs),std::adopt_lock);
+	auto& inomap = ishard.rmap[sinfo.st_dev];
 	auto it = inomap.find(sinfo.st_ino);
-	if ( it == inomap.end() ) {
-		Fileno_t fileno = uid_pool.allocate();
-		s_file_ent& fent = fmap[fileno];
-		fent.fileno = fileno;
-		fent.st_dev = sinfo.st_dev;
-		fent.st_ino = sinfo.st_ino;
-		fent.st_size = sinfo.st_size;
-		fent.st_nlink = sinfo.st_nlink;
-#if ST_MTIMESPEC
-		fent.st_mtimespec = sinfo.st_mtimespec;
-#else
-		fent.st_mtimespec.tv_sec = sinfo.st_mtime;
-		fent.st_mtimespec.tv_nsec = 0;
-#endif
-		fent.path = name_pool.add_names(list);
 
-		// Track by device & inode
-		rmap[sinfo.st_dev][sinfo.st_ino] = fileno;
+	if ( it != inomap.end() ) {
+		Fileno_t fileno = it->second;
+
+		ishard.links[fileno].push_back(names_path); // Hard links to same content
+		ilock.unlock();
+		metrics.add(Metric::Links);
+		if ( linked )
+			*linked = true;
+		if ( metrics.timing )
+			metrics.add(Metric::RegisterNs,Metrics::ns_since(t0));
+		return fileno;
+	}
+
+	Fileno_t fileno = file_pool.allocate();
+	const unsigned cx = fileno >> chunk_bits;
+
+	assert(cx < nchunks);
+	if ( !chunks[cx].load(std::memory_order_acquire) ) {
+		std::lock_guard<std::mutex> lock(chunk_mutex);
 
-		// Track files by size
-		by_size[fent.st_size].insert(fileno);
-		return fent.fileno;
+		if ( !chunks[cx].load() )
+			chunks[cx].store(new s_chunk(),std::memory_order_release);
 	}
 
-	Fileno_t fileno = it->second;
-	s_file_ent& fent = fmap.at(fileno);
+	// Track by device & inode
+	inomap[sinfo.st_ino] = fileno;
 
-	fent.links.insert(name_pool.add_names(list)); // Hard links to same content
+	s_chunk& ch = chunk(fileno);
+	const unsigned sx = slot(fileno);
+	s_file_ent& fent = ch.cold[sx];
+
+	ch.st_dev[sx] = sinfo.st_dev;
+	ch.st_ino[sx] = sinfo.st_ino;
+	ch.st_size[sx] = sinfo.st_size;
+	fent.st_nlink = sinfo.st_nlink;
+#if ST_MTIMESPEC
+	fent.st_mtimespec = sinfo.st_mtimespec;
+#elif ST_MTIM
+	fent.st_mtimespec = sinfo.st_mtim;
+#else
+	fent.st_mtimespec.tv_sec = sinfo.st_mtime;
+	fent.st_mtimespec.tv_nsec = 0;
+#endif
+	fent.path = names_path;
+	ilock.unlock();
+	++nfiles;
+	metrics.add(Metric::Files);
+	if ( metrics.timing )
+		metrics.add(Metric::RegisterNs,Metrics::ns_since(t0));
 	return fileno;
 }
 
-s_file_ent&
-GlobalFiles::lookup(dev_t dev,ino_t ino) {
-	std::lock_guard<std::recursive_mutex> lock(mutex);
+//////////////////////////////////////////////////////////////////////
+// Return the other names (hard links) of a file, if any
+//////////////////////////////////////////////////////////////////////
 
-	auto it = rmap.find(dev);
-	assert(it != rmap.end());
-	auto r2map = it->second;
-	auto i2 = r2map.find(ino);
-	assert(i2 != r2map.end());
-	return fmap.at(i2->second);
-}
+std::vector<PathRef>
+GlobalFiles::links(Fileno_t fileno) {
+	s_inode_shard& ishard = inode_shards[inode_shard(st_dev(fileno),st_ino(fileno))];
+	std::unique_lock<std::mutex> lock(ishard.mutex,std::defer_lock);
 
-s_file_ent&
-GlobalFiles::lookup(Fileno_t fileno) {
-	std::lock_guard<std::recursive_mutex> lock(mutex);
+	if ( !frozen.load() )
+		lock.lock();
 
-	auto it = fmap.find(fileno);
-	assert(it != fmap.end());
+	auto it = ishard.links.find(fileno);
+	if ( it == ishard.links.end() )
+		return std::vector<PathRef>();
 	return it->second;
 }
 
-std::unordered_map<off_t,std::unordered_set<Fileno_t>>
-GlobalFiles::dup_candidates() {
-	std::unordered_map<off_t,std::unordered_set<Fileno_t>> candidates;
+std::string
+GlobalFiles::pathname(const PathRef& path) {
+	return dir_tree.pathname(path.dir,path.name);
+}
 
-	for ( auto& pair : by_size ) {
-		auto& uset = pair.second;
+std::string
+GlobalFiles::pathname(Fileno_t file) {
 
-		if ( uset.size() > 1 )
-			candidates.insert(pair);
-	}
-	return candidates;
+	if ( file == 0 || !chunks[file >> chunk_bits].load() )
+		return "";		// No such file (nfiles lags out of order adds)
+	return pathname(lookup(file).path);
 }
 
-std::string
-GlobalFiles::namestr_pathname(const NameStr_t& path) {
-	std::stringstream ss;
+//////////////////////////////////////////////////////////////////////
+// Compare a group of same sized files in lockstep, a block at a
+// time. After each block the group is split by content, and any
+// file left on its own is dropped, so each byte of each file is
+// read once. Returns the equivalence classes of two or more files,
+// as indexes into paths. A file that cannot be read has its errno
+// left in errors[].
+//
+// The comparison starts at offset. When split is given, the call
+// returns as soon as the group divides, leaving the sub-groups that
+// still need comparing (and the offset to resume from) in *split.
+//
+// Blocks are FileReader::chunk bytes, made smaller for large groups
+// so that the group's buffers stay within group_budget. At most
+// compare_fds files stay open: the rest are opened for each block
+// and closed again, keeping a copy of the block. Running out of
+// descriptors (EMFILE, ENFILE) is not held against the file: the
+// open is retried once other files, or other threads, have given
+// some back. A file truncated under the mmap engine fails with EIO,
+// and the others are compared without it.
+//////////////////////////////////////////////////////////////////////
+
+std::vector<std::vector<unsigned>>
+GlobalFiles::compare_paths(const std::vector<std::string>& paths,off_t& offset,std::vector<int>& errors,
+  std::vector<std::vector<unsigned>> *split) {
+	static const size_t group_budget = 64 * 1024 * 1024;
+	static const size_t min_blksiz = 65536;
+	static const unsigned open_retries = 10;	// 1ms doubling to ~1s
+	struct s_member {
+		unsigned	index;
+		bool		keep = false;	// Holds one of the compare_fds
+		FileReader	rd;
+		const char	*data = nullptr;
+		ssize_t		rc = 0;
+		std::vector<char> copy;		// Block of a member not kept open
+	};
+	std::vector<std::vector<unsigned>> classes;
+	std::vector<s_member> members(paths.size());
+	std::vector<std::vector<s_member*>> work;
+	size_t blksiz = FileReader::chunk;
+	unsigned nkept = 0;
+
+	if ( paths.size() * blksiz > group_budget )
+		blksiz = std::max(min_blksiz,(group_budget / paths.size()) & ~size_t(4095));
+
+	errors.assign(paths.size(),0);
+
+	// Open m, waiting out a shortage of descriptors
+	auto open = [&](s_member& m) -> bool {
+		const std::string& path = paths[m.index];
+
+		for ( unsigned tries=0; !path.empty(); ++tries ) {
+			if ( m.rd.open(path.c_str(),blksiz) >= 0 )
+				return true;
+			if ( (m.rd.error != EMFILE && m.rd.error != ENFILE) || tries >= open_retries )
+				break;
+			::usleep(1000u << tries);
+		}
+		errors[m.index] = m.rd.error ? m.rd.error : ENOENT;
+		fprintf(stderr,"%s: opening %s for compare\n",
+			strerror(errors[m.index]),path.c_str());
+		return false;
+	};
+
+	work.emplace_back();
+	for ( unsigned mx=0; mx < paths.size(); ++mx ) {
+		s_member& m = members[mx];
+
+		m.index = mx;
+		if ( nkept < compare_fds ) {
+			if ( !open(m) )
+				continue;
+			m.keep = true;
+			++nkept;
+		}
+		work.back().push_back(&m);
+	}
 
-	for ( auto name_id : path ) {
-		const std::string& sname = name_pool.lookup(name_id);
-		assert(!sname.empty());
-		ss << '/' << sname;
+	for ( ; !work.empty(); offset += blksiz ) {
+		std::vector<std::vector<s_member*>> next;
+
+		for ( auto& group : work ) {
+			std::vector<std::vector<s_member*>> parts;
+
+			if ( group.size() < 2 )
+				continue;
+
+			// Fail m, a file truncated under its mapping
+			auto truncated = [&](s_member *m) {
+				errors[m->index] = EIO;
+				fprintf(stderr,"File changed size: %s\n",paths[m->index].c_str());
+				m->rd.close();
+			};
+
+			for ( auto mp : group ) {
+				if ( !mp->rd.is_open() && !open(*mp) )
+					continue;
+				mp->rc = mp->rd.read(offset,blksiz,mp->data);
+				if ( mp->rc == -1 ) {
+					errors[mp->index] = mp->rd.error;
+					mp->rd.close();
+					continue;
+				}
+
+				std::vector<s_member*> *placed = nullptr;
+				const void *fault;
+
+				while ( !FileReader::guard([&]() {
+					placed = nullptr;
+					for ( auto& part : parts ) {
+						const s_member *rep = part.front();
+
+						if ( rep->rc == mp->rc
+						  && memcmp(rep->data,mp->data,mp->rc) == 0 ) {
+							placed = &part;
+							break;
+						}
+					}
+					if ( !mp->keep ) {
+						mp->copy.assign(mp->data,mp->data + mp->rc);
+						mp->data = mp->copy.data();
+					}
+				},fault) ) {
+					// Drop whichever file it was, and try again
+					auto it = std::find_if(parts.begin(),parts.end(),[&](std::vector<s_member*>& part) {
+						return part.front()->rd.maps(fault);
+					});
+
+					if ( it == parts.end() ) {
+						truncated(mp);
+						break;
+					}
+					truncated(it->front());
+					it->erase(it->begin());
+					if ( it->empty() )
+						parts.erase(it);
+				}
+				if ( errors[mp->index] )
+					continue;
+				if ( placed )
+					placed->push_back(mp);
+				else	parts.emplace_back(1,mp);
+				if ( !mp->keep )
+					mp->rd.close();
+			}
+
+			for ( auto& part : parts ) {
+				if ( part.size() < 2 ) {
+					part.front()->rd.close();
+					continue;	// Singleton: no longer a candidate
+				}
+				if ( part.front()->rc == 0 ) {
+					// End of file reached: an equivalence class
+					classes.emplace_back();
+					for ( auto mp : part ) {
+						classes.back().push_back(mp->index);
+						mp->rd.close();
+					}
+				} else	next.push_back(std::move(part));
+			}
+		}
+		work = std::move(next);
+
+		if ( split && work.size() > 1 ) {
+			offset += blksiz;
+			for ( auto& group : work ) {
+				split->emplace_back();
+				for ( auto mp : group )
+					split->back().push_back(mp->index);
+			}
+			break;
+		}
 	}
-	std::string r(ss.str());
-	return r;
+	return classes;
 }
 
-std::string
-GlobalFiles::pathname(Fileno_t file) {
+std::vector<std::vector<Fileno_t>>
+GlobalFiles::compare_group(const std::vector<Fileno_t>& files,off_t& offset,std::vector<std::vector<Fileno_t>> *split) {
+	std::vector<std::string> paths;
+	std::vector<int> errors;
+	std::vector<std::vector<unsigned>> isplit;
+	std::vector<std::vector<Fileno_t>> classes;
+
+	for ( auto file : files )
+		paths.push_back(pathname(file));
+
+	auto iclasses = compare_paths(paths,offset,errors,split ? &isplit : nullptr);
 
-	auto it = fmap.find(file);
-	if ( it == fmap.end() )
-		return "";
-	const auto& fent = it->second;
+	for ( unsigned fx=0; fx < files.size(); ++fx )
+		if ( errors[fx] != 0 )
+			error(files[fx]) = errors[fx];
 
-	return namestr_pathname(fent.path);
+	for ( auto& iclass : iclasses ) {
+		classes.emplace_back();
+		for ( auto ix : iclass )
+			classes.back().push_back(files[ix]);
+	}
+	for ( auto& igroup : isplit ) {
+		split->emplace_back();
+		for ( auto ix : igroup )
+			split->back().push_back(files[ix]);
+	}
+	return classes;
 }
 
-Compare
-GlobalFiles::compare_equal(Fileno_t f1,Fileno_t f2) {
-	std::string path1 = pathname(f1);
-	std::string path2 = pathname(f2);
+//////////////////////////////////////////////////////////////////////
+// Hash the full content of a file, reading it exactly once.
+// Returns false if the file could not be opened or read.
+//////////////////////////////////////////////////////////////////////
+
+bool
+GlobalFiles::content_hash(const std::string& path,hash128_t& hash) {
 
-	if ( path1.empty() || path2.empty() )
-		return Compare::Error;
+	if ( path.empty() )
+		return false;
 
-	File_Guard fg1(path1.c_str());
-	File_Guard fg2(path2.c_str());
+	FileReader rd;
+	Hash128 h;
 	off_t offset = 0;
-	char buf1[4096], buf2[sizeof buf1];
-	int rc1, rc2;
-
-	if ( fg1.fd < 0 || fg2.fd < 0 )
-		return Compare::Error;
-
-	for ( offset=0; ; offset += sizeof buf1 ) {
-		rc1 = fg1.read(buf1,sizeof buf1,offset);
-		rc2 = fg2.read(buf2,sizeof buf2,offset);
-		if ( rc1 == -1 || rc2 == -1 )
-			return Compare::Error;
-		else if ( rc1 != rc2 )
-			return Compare::NotEqual;
-		if ( memcmp(buf1,buf2,rc1) != 0 )
-			return Compare::NotEqual;
-		if ( rc1 == 0 )
+	const char *data;
+	ssize_t rc;
+
+	if ( rd.open(path.c_str()) < 0 ) {
+		errno = rd.error;
+		return false;
+	}
+
+	for (;;) {
+		rc = rd.read(offset,FileReader::chunk,data);
+		if ( rc == -1 ) {
+			errno = rd.error;
+			return false;
+		}
+		if ( rc == 0 )
 			break;
+
+		const void *fault;
+
+		if ( !FileReader::guard([&]() { h.update(data,rc); },fault) ) {
+			errno = EIO;		// Truncated under its mapping
+			return false;
+		}
+		offset += rc;
 	}
-	return Compare::Equal;	
+	hash = h.final();
+	return true;
+}
+
+bool
+GlobalFiles::content_hash(Fileno_t file,hash128_t& hash) {
+	return content_hash(pathname(file),hash);
 }
 
 void
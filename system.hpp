@@ -7,6 +7,8 @@
 #define SYSTEM_HPP
 
 #include "config.hpp"
+#include "hash128.hpp"
+#include "hashkern.hpp"
 
 #include <stdarg.h>
 #include <stdint.h>
@@ -22,28 +24,35 @@
 #include <unordered_set>
 #include <list>
 #include <string>
+#include <string_view>
 #include <atomic>
-#include <queue>
 #include <set>
+#include <vector>
 
 typedef uint32_t crc32_t;
 typedef uint64_t Fileno_t;
-typedef uint64_t Name_t;
-typedef std::basic_string<Name_t> NameStr_t;
+typedef uint32_t Name_t;
+typedef uint32_t Dirno_t;
+
+struct PathRef {
+	Dirno_t		dir;		// Directory node (DirTree)
+	Name_t		name;		// Name within the directory
+};
 typedef uint32_t dup_t;
 
+//////////////////////////////////////////////////////////////////////
+// The less used per-file data. The fields scanned by the candidate
+// and compare stages (size, fingerprint, device/inode, error and
+// duplicate id) are kept in separate arrays by GlobalFiles.
+//////////////////////////////////////////////////////////////////////
+
 struct s_file_ent {
-	Fileno_t	fileno;		// Internal file number
-	dev_t		st_dev;		// Device number
-	ino_t		st_ino;		// Inode number
-	off_t		st_size;	// File size in bytes
+	PathRef		path;		// Path to the file
 	nlink_t		st_nlink;	// # of hard links
 	timespec	st_mtimespec;	// Time of last modification
-	NameStr_t	path;		// Path to the file
-	uint32_t	crc32=0;	// CTC32 of first 1-k
-	int		error=0;	// Non-zero if open fails
-	dup_t		duplicate=0;	// Non-zero when duplicate ID
-	std::set<NameStr_t> links;	// Hard links to same content
+	hash128_t	hash;		// Hash of full content
+	bool		fprint_ok=false; // fprint is valid
+	bool		hash_ok=false;	// hash is valid
 };
 
 template<typename T>
@@ -56,40 +65,81 @@ public:	Uid() : next_uid(0) { }
 	}
 };
 
-class Names : Uid<Name_t> {
-	std::mutex				mutex;
-	std::unordered_map<std::string,Name_t>	names;
-	std::unordered_map<Name_t,const char *>	rev_names;
+//////////////////////////////////////////////////////////////////////
+// Interned names. The name table is sharded by hash, each shard with
+// its own lock and arena for the strings. A Name_t holds the shard
+// number in its low bits, so lookup() goes straight to the string
+// without taking a lock.
+//////////////////////////////////////////////////////////////////////
+
+class Names {
+	static const unsigned shard_bits = 6;
+	static const unsigned nshards = 1u << shard_bits;
+	static const unsigned chunk_bits = 14;		// Names per index chunk
+	static const unsigned nchunks = 1u << (32 - shard_bits - chunk_bits);
+	static const size_t arena_size = 256 * 1024;
+
+	struct s_shard {
+		std::mutex					mutex;
+		std::unordered_map<std::string_view,Name_t>	names;
+		std::atomic<const char **>			index[nchunks];
+		uint32_t					count = 0;
+		char						*arena = nullptr;
+		size_t						arena_left = 0;
+		std::vector<char *>				arenas;
+
+		s_shard();
+		~s_shard();
+		const char *store(const char *name,size_t len);
+	};
+
+	s_shard		shards[nshards];
+	std::atomic<size_t> nnames;
 
-public:	Names() {}
+public:	Names() : nnames(0) {}
 	Name_t name_register(const char *name);
-	std::string lookup(Name_t name_id);
-	size_t size() { return names.size(); }
-	NameStr_t add_names(std::list<std::string>& list_path);
+	const char *lookup(Name_t name_id);
+	size_t size() { return nnames.load(); }
 };
 
-template<typename T>
-class Queue : public std::queue<T> {
-	std::mutex	mutex;
+//////////////////////////////////////////////////////////////////////
+// Directories form a tree of (parent, name) nodes, so a pathname is
+// rebuilt by walking up to the root. Node 0 is the root directory.
+// Nodes are kept in fixed chunks, so reading a node takes no lock.
+//////////////////////////////////////////////////////////////////////
 
-public:	Queue() {}
-	void push(const T& s) {
-		std::lock_guard<std::mutex> lock(mutex);
-		std::queue<T>::push(s);
-	}
-	bool pop(T& s) {
-		std::lock_guard<std::mutex> lock(mutex);
-
-		if ( this->empty() )
-			return false;
-		s = std::queue<T>::front();
-		std::queue<T>::pop();
-		return true;
+class DirTree {
+	static const unsigned chunk_bits = 16;
+	static const unsigned nchunks = 1u << (32 - chunk_bits);
+
+	struct s_node {
+		Dirno_t		parent;
+		Name_t		name;
+	};
+
+	std::atomic<s_node *>	chunks[nchunks];
+	std::atomic<Dirno_t>	next;
+	std::mutex		mutex;		// Chunk allocation
+	std::mutex		intern_mutex;
+	std::unordered_map<uint64_t,Dirno_t> interned; // Nodes made by intern()
+
+	s_node& node(Dirno_t dir) {
+		return chunks[dir >> chunk_bits].load()[dir & ((1u << chunk_bits) - 1)];
 	}
+
+public:	static const Dirno_t root = 0;
+
+	DirTree();
+	~DirTree();
+	Dirno_t add(Dirno_t parent,Name_t name);
+	Dirno_t intern(const char *abspath);
+	size_t size() { return next.load(); }
+	std::string pathname(Dirno_t dir,Name_t name=0);
 };
 
 extern Uid<Fileno_t>	uid_pool;
 extern Names		name_pool;
+extern DirTree		dir_tree;
 
 class File_Guard {
 public:
@@ -130,33 +180,97 @@ public:
 	}
 };
 
-enum class Compare {
-	Equal,
-	NotEqual,
-	Error
-};
+//////////////////////////////////////////////////////////////////////
+// Files are numbered densely from 1, and their data is kept in
+// fixed chunks indexed by Fileno_t. Within a chunk each hot field
+// is an array of its own, so a stage that scans sizes or
+// fingerprints touches only those. Hard link names are rare and
+// live in a side table of the inode shard.
+//
+// Inode shards (by st_dev/st_ino) find hard links, each with its
+// own lock. Grouping by size is left to the candidate table, which
+// is built from st_size once traversal is complete. Entries are
+// reached without a lock, and once freeze() is called links() takes
+// none either.
+//////////////////////////////////////////////////////////////////////
 
 class GlobalFiles {
-	std::recursive_mutex				mutex;
-	std::unordered_map<Fileno_t,s_file_ent> 	fmap;
-	std::unordered_map<dev_t,std::unordered_map<ino_t,Fileno_t>> rmap;
-	std::unordered_map<off_t,std::unordered_set<Fileno_t>> by_size;
+	static const unsigned nshards = 64;
+	static const unsigned chunk_bits = 14;		// Files per chunk
+	static const unsigned chunk_size = 1u << chunk_bits;
+	static const unsigned nchunks = 1u << (32 - chunk_bits);
+
+	struct s_chunk {
+		off_t		st_size[chunk_size];	// File size in bytes
+		fprint_t	fprint[chunk_size];	// Fingerprint of first 1-k
+		dev_t		st_dev[chunk_size];	// Device number
+		ino_t		st_ino[chunk_size];	// Inode number
+		int		error[chunk_size];	// Non-zero if open fails
+		dup_t		duplicate[chunk_size];	// Non-zero when duplicate ID
+		s_file_ent	cold[chunk_size];
+	};
+
+	struct s_inode_shard {
+		std::mutex		mutex;
+		std::unordered_map<dev_t,std::unordered_map<ino_t,Fileno_t>> rmap;
+		std::unordered_map<Fileno_t,std::vector<PathRef>> links;
+	};
+
+	std::atomic<s_chunk *>				chunks[nchunks];
+	std::mutex					chunk_mutex;
+	s_inode_shard					inode_shards[nshards];
+	std::atomic<size_t>				nfiles;
+	std::atomic<bool>				frozen;
 	Uid<Fileno_t>&					file_pool;
 
-public:	GlobalFiles(Uid<Fileno_t>& fpool) : file_pool(fpool) {}
-	Fileno_t add(const char *path);
-	size_t size() { return fmap.size(); }
-	s_file_ent& lookup(dev_t dev,ino_t ino);
-	s_file_ent& lookup(Fileno_t fileno);
+	static unsigned inode_shard(dev_t dev,ino_t ino) {
+		uint64_t h = (uint64_t(dev) * 0x9E3779B97F4A7C15ULL) ^ uint64_t(ino);
 
-	std::string namestr_pathname(const NameStr_t& path);
+		return (h ^ (h >> 29)) % nshards;
+	}
+
+	s_chunk& chunk(Fileno_t fileno) {
+		return *chunks[fileno >> chunk_bits].load(std::memory_order_acquire);
+	}
+	static unsigned slot(Fileno_t fileno) { return fileno & (chunk_size - 1); }
+
+public:	static unsigned	compare_fds;	// Files one compare keeps open
+
+	GlobalFiles(Uid<Fileno_t>& fpool);
+	~GlobalFiles();
+	Fileno_t add(Dirno_t dir,const char *name,const struct stat& sinfo,bool *linked=nullptr);
+	size_t size() { return nfiles.load(); }
+	s_file_ent& lookup(Fileno_t fileno) { return chunk(fileno).cold[slot(fileno)]; }
+	void freeze() { frozen.store(true); }
+
+	off_t& st_size(Fileno_t fileno) { return chunk(fileno).st_size[slot(fileno)]; }
+	fprint_t& fprint(Fileno_t fileno) { return chunk(fileno).fprint[slot(fileno)]; }
+	dev_t& st_dev(Fileno_t fileno) { return chunk(fileno).st_dev[slot(fileno)]; }
+	ino_t& st_ino(Fileno_t fileno) { return chunk(fileno).st_ino[slot(fileno)]; }
+	int& error(Fileno_t fileno) { return chunk(fileno).error[slot(fileno)]; }
+	dup_t& duplicate(Fileno_t fileno) { return chunk(fileno).duplicate[slot(fileno)]; }
+	std::vector<PathRef> links(Fileno_t fileno);
+	static size_t bytes_per_file() { return sizeof(s_chunk) / chunk_size; }
+
+	std::string pathname(const PathRef& path);
 	std::string pathname(Fileno_t file);
-	Compare compare_equal(Fileno_t f1,Fileno_t f2);
-	std::unordered_map<off_t,std::unordered_set<Fileno_t>> dup_candidates();
+	bool content_hash(Fileno_t file,hash128_t& hash);
+	std::vector<std::vector<Fileno_t>> compare_group(const std::vector<Fileno_t>& files,off_t& offset,
+		std::vector<std::vector<Fileno_t>> *split=nullptr);
+	static bool content_hash(const std::string& path,hash128_t& hash);
+	static std::vector<std::vector<unsigned>> compare_paths(const std::vector<std::string>& paths,off_t& offset,
+		std::vector<int>& errors,std::vector<std::vector<unsigned>> *split=nullptr);
+
+	// Call func(fileno) for every registered file
+	template<typename F> void for_each(F func) {
+		const Fileno_t last = Fileno_t(nfiles.load());
+
+		for ( Fileno_t fileno=1; fileno <= last; ++fileno )
+			func(fileno);
+	}
 
 	static std::string abspath(const char *filename);
 	static std::list<std::string> pathparse(const char *pathname);
-	static void crc32(uint32_t& crc32,const void *buf,size_t buflen);
 };
 
 void vtracef(int level,const char *format,va_list ap);
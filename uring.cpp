@@ -0,0 +1,484 @@
+//////////////////////////////////////////////////////////////////////
+// uring.cpp -- io_uring batch reader for fingerprints and hashes
+// Date: Sun Oct 18 19:48:31 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+#include <algorithm>
+
+#include "config.hpp"
+#include "uring.hpp"
+#include "metrics.hpp"
+
+#if HAVE_IO_URING
+#include <linux/io_uring.h>
+
+enum { OpOpen = 0, OpRead = 1, OpClose = 2 };
+
+static const size_t page_size = 4096;
+
+static int
+sys_setup(unsigned entries,io_uring_params *params) {
+	return syscall(__NR_io_uring_setup,entries,params);
+}
+
+static int
+sys_enter(int fd,unsigned to_submit,unsigned min_complete,unsigned flags) {
+	return syscall(__NR_io_uring_enter,fd,to_submit,min_complete,flags,nullptr,0);
+}
+
+static int
+sys_register(int fd,unsigned opcode,const void *arg,unsigned nr_args) {
+	return syscall(__NR_io_uring_register,fd,opcode,arg,nr_args);
+}
+
+//////////////////////////////////////////////////////////////////////
+// Set up a ring for depth slots of bufsiz bytes. Returns 0, or errno
+// when io_uring (or an operation needed) is not available.
+//////////////////////////////////////////////////////////////////////
+
+int
+Uring::open(unsigned depth,size_t bufsiz,bool direct) {
+	io_uring_params params;
+	unsigned entries = 4;
+	int rc;
+
+	close();
+	while ( entries < depth * 4 )
+		entries <<= 1;		// Open, read and close per slot
+
+	memset(&params,0,sizeof params);
+	if ( (fd = sys_setup(entries,&params)) == -1 ) {
+		fd = -1;
+		return errno;
+	}
+
+	sq_entries = params.sq_entries;
+	sq_ring_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_ring_sz = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if ( params.features & IORING_FEAT_SINGLE_MMAP )
+		sq_ring_sz = cq_ring_sz = std::max(sq_ring_sz,cq_ring_sz);
+	sqes_sz = params.sq_entries * sizeof(io_uring_sqe);
+
+	sq_ring = mmap(nullptr,sq_ring_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQ_RING);
+	if ( sq_ring == MAP_FAILED ) {
+		sq_ring = nullptr;
+		rc = errno;
+		close();
+		return rc;
+	}
+	if ( params.features & IORING_FEAT_SINGLE_MMAP )
+		cq_ring = sq_ring;
+	else	{
+		cq_ring = mmap(nullptr,cq_ring_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_CQ_RING);
+		if ( cq_ring == MAP_FAILED ) {
+			cq_ring = nullptr;
+			rc = errno;
+			close();
+			return rc;
+		}
+	}
+	sqes = mmap(nullptr,sqes_sz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,fd,IORING_OFF_SQES);
+	if ( sqes == MAP_FAILED ) {
+		sqes = nullptr;
+		rc = errno;
+		close();
+		return rc;
+	}
+
+	char *sq = (char *)sq_ring, *cq = (char *)cq_ring;
+
+	sq_head = (unsigned *)(sq + params.sq_off.head);
+	sq_tail = (unsigned *)(sq + params.sq_off.tail);
+	sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+	sq_array = (unsigned *)(sq + params.sq_off.array);
+	cq_head = (unsigned *)(cq + params.cq_off.head);
+	cq_tail = (unsigned *)(cq + params.cq_off.tail);
+	cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+	cqes = cq + params.cq_off.cqes;
+	tail = *sq_tail;
+
+	// The operations used must all be supported
+	{
+		std::vector<char> mem(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op),0);
+		io_uring_probe *probe = (io_uring_probe *)mem.data();
+
+		if ( sys_register(fd,IORING_REGISTER_PROBE,probe,256) == -1 ) {
+			rc = errno;
+			close();
+			return rc;
+		}
+		for ( unsigned op : { IORING_OP_OPENAT, IORING_OP_CLOSE, IORING_OP_READ, IORING_OP_READ_FIXED } )
+			if ( op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED) ) {
+				close();
+				return EOPNOTSUPP;
+			}
+	}
+
+	// An empty fixed file table, a slot each
+	std::vector<int> fds(depth,-1);
+
+	if ( sys_register(fd,IORING_REGISTER_FILES,fds.data(),depth) == -1 ) {
+		rc = errno;
+		close();
+		return rc;
+	}
+
+	void *mem = nullptr;
+
+	this->bufsiz = bufsiz = (bufsiz + page_size - 1) & ~(page_size - 1);
+	if ( posix_memalign(&mem,page_size,depth * bufsiz) != 0 ) {
+		close();
+		return ENOMEM;
+	}
+	bufs = (char *)mem;
+
+	// Registered buffers count against RLIMIT_MEMLOCK: without them,
+	// plain reads are used
+	std::vector<iovec> iovs(depth);
+
+	for ( unsigned sx=0; sx < depth; ++sx ) {
+		iovs[sx].iov_base = bufs + sx * bufsiz;
+		iovs[sx].iov_len = bufsiz;
+	}
+	fixed_bufs = sys_register(fd,IORING_REGISTER_BUFFERS,iovs.data(),depth) == 0;
+
+	this->direct = direct;
+	slots.assign(depth,s_slot());
+	free_slots.clear();
+	for ( unsigned sx=depth; sx-- > 0; )
+		free_slots.push_back(sx);
+	ninflight = 0;
+	dead = 0;
+	return 0;
+}
+
+void
+Uring::close() {
+
+	if ( sqes )
+		munmap(sqes,sqes_sz);
+	if ( cq_ring && cq_ring != sq_ring )
+		munmap(cq_ring,cq_ring_sz);
+	if ( sq_ring )
+		munmap(sq_ring,sq_ring_sz);
+	sqes = sq_ring = cq_ring = nullptr;
+	if ( fd >= 0 ) {
+		::close(fd);		// Closes any fixed files too
+		fd = -1;
+	}
+	if ( bufs ) {
+		::free(bufs);
+		bufs = nullptr;
+	}
+	slots.clear();
+	free_slots.clear();
+	ninflight = to_submit = 0;
+	dead = 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Can io_uring be used here? Tries a ring once, and opens a file into
+// its fixed table (which needs Linux 5.15), keeping the answer.
+//////////////////////////////////////////////////////////////////////
+
+bool
+Uring::available(int& error) {
+	static int rc = []() -> int {
+		Uring ring;
+		std::vector<unsigned> done;
+		int rc = ring.open(1,page_size);
+
+		if ( rc )
+			return rc;
+		ring.prefix("/",1);		// Opens, though not readable
+		ring.wait(done);
+		return ring.opened(0) ? 0 : ring.error(0) ? ring.error(0) : EOPNOTSUPP;
+	}();
+
+	error = rc;
+	return rc == 0;
+}
+
+void *
+Uring::get_sqe() {
+	const unsigned head = __atomic_load_n(sq_head,__ATOMIC_ACQUIRE);
+
+	if ( tail - head >= sq_entries )
+		submit(0);		// Full: the kernel takes them all
+
+	io_uring_sqe *sqe = (io_uring_sqe *)sqes + (tail & *sq_mask);
+
+	memset(sqe,0,sizeof *sqe);
+	sq_array[tail & *sq_mask] = tail & *sq_mask;
+	++tail;
+	++to_submit;
+	return sqe;
+}
+
+void
+Uring::queue_open(unsigned slot,bool link) {
+	io_uring_sqe *sqe = (io_uring_sqe *)get_sqe();
+
+	sqe->opcode = IORING_OP_OPENAT;
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uint64_t)slots[slot].path.c_str();
+	sqe->open_flags = O_RDONLY | (direct && !slots[slot].buffered ? O_DIRECT : 0);
+	sqe->file_index = slot + 1;
+	sqe->flags = link ? IOSQE_IO_HARDLINK : 0;
+	sqe->user_data = uint64_t(slot) << 2 | OpOpen;
+	++slots[slot].pending;
+}
+
+void
+Uring::queue_read(unsigned slot,bool link) {
+	s_slot& s = slots[slot];
+	io_uring_sqe *sqe = (io_uring_sqe *)get_sqe();
+	size_t len = s.whole ? bufsiz : s.size;
+
+	if ( direct && !s.buffered )
+		len = std::min(bufsiz,(len + page_size - 1) & ~(page_size - 1));
+	sqe->opcode = fixed_bufs ? IORING_OP_READ_FIXED : IORING_OP_READ;
+	sqe->fd = slot;
+	sqe->flags = IOSQE_FIXED_FILE | (link ? IOSQE_IO_HARDLINK : 0);
+	sqe->addr = (uint64_t)(bufs + slot * bufsiz);
+	sqe->len = len;
+	sqe->off = s.offset;
+	sqe->buf_index = slot;
+	sqe->user_data = uint64_t(slot) << 2 | OpRead;
+	++s.pending;
+}
+
+void
+Uring::queue_close(unsigned slot) {
+	io_uring_sqe *sqe = (io_uring_sqe *)get_sqe();
+
+	sqe->opcode = IORING_OP_CLOSE;
+	sqe->file_index = slot + 1;
+	sqe->user_data = uint64_t(slot) << 2 | OpClose;
+	++slots[slot].pending;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start reading the first bytes (<= bufsiz) of path: a linked open,
+// read and close. Returns the slot.
+//////////////////////////////////////////////////////////////////////
+
+unsigned
+Uring::prefix(const std::string& path,size_t bytes) {
+	const unsigned slot = free_slots.back();
+	s_slot& s = slots[slot];
+
+	free_slots.pop_back();
+	s.busy = true;
+	s.whole = false;
+	s.path = path;
+	s.size = std::min(bytes,bufsiz);
+	s.offset = 0;
+	s.pending = 0;
+	s.opened = false;
+	s.buffered = false;
+	s.error = 0;
+	queue_open(slot,true);
+	queue_read(slot,true);
+	queue_close(slot);
+	++ninflight;
+	return slot;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Start hashing path, a buffer at a time up to end of file (as for
+// FileReader, st_size does not matter: /proc files have none)
+//////////////////////////////////////////////////////////////////////
+
+unsigned
+Uring::whole(const std::string& path) {
+	const unsigned slot = free_slots.back();
+	s_slot& s = slots[slot];
+
+	free_slots.pop_back();
+	s.busy = true;
+	s.whole = true;
+	s.path = path;
+	s.size = 0;
+	s.offset = 0;
+	s.pending = 0;
+	s.opened = false;
+	s.buffered = false;
+	s.error = 0;
+	s.eof = false;
+	s.hash.reset();
+	queue_open(slot,true);
+	queue_read(slot,false);
+	++ninflight;
+	return slot;
+}
+
+int
+Uring::submit(unsigned min_complete) {
+	int rc;
+
+	__atomic_store_n(sq_tail,tail,__ATOMIC_RELEASE);
+	do	{
+		rc = sys_enter(fd,to_submit,min_complete,min_complete ? IORING_ENTER_GETEVENTS : 0);
+	} while ( rc == -1 && errno == EINTR );
+
+	if ( rc > 0 ) {
+		to_submit -= std::min(unsigned(rc),to_submit);
+		stats.sqes += rc;
+	}
+	++stats.submits;
+	return rc;
+}
+
+//////////////////////////////////////////////////////////////////////
+// Handle one completion. A whole file read goes on to its next read
+// (or close) once nothing else is pending for its slot.
+//////////////////////////////////////////////////////////////////////
+
+void
+Uring::complete(unsigned slot,uint64_t op,int res,std::vector<unsigned>& done) {
+	s_slot& s = slots[slot];
+
+	--s.pending;
+	switch ( op ) {
+	case OpOpen:
+		if ( res < 0 )
+			s.error = -res;
+		else	{
+			s.opened = true;
+			metrics.add(Metric::FilesRead);
+		}
+		break;
+	case OpRead:
+		if ( res < 0 ) {
+			if ( !s.error )
+				s.error = -res;
+			break;
+		}
+		s.opened = true;
+		stats.bytes += res;
+		metrics.add(Metric::BytesRead,res);
+		if ( !s.whole ) {
+			s.offset = std::min(uint64_t(res),s.size);
+			break;
+		}
+		s.hash.update(bufs + slot * bufsiz,res);
+		s.offset += res;
+		s.eof = res == 0;
+		break;
+	case OpClose:
+		s.whole = false;	// Nothing more to do
+		break;
+	}
+
+	if ( s.pending > 0 )
+		return;
+
+	if ( direct && !s.opened && s.error == EINVAL && !s.buffered ) {
+		// The filesystem refuses O_DIRECT: start over without it
+		s.buffered = true;
+		s.error = 0;
+		queue_open(slot,true);
+		queue_read(slot,!s.whole);
+		if ( !s.whole )
+			queue_close(slot);
+		return;
+	}
+
+	if ( s.whole ) {
+		if ( s.opened && !s.error && !s.eof ) {
+			queue_read(slot,false);
+			return;
+		}
+		if ( s.opened ) {
+			queue_close(slot);
+			return;
+		}
+	}
+
+	s.busy = false;
+	--ninflight;
+	free_slots.push_back(slot);
+	done.push_back(slot);
+}
+
+//////////////////////////////////////////////////////////////////////
+// The ring cannot be entered any more: finish every slot in flight
+// with error (and any started later, as wait() is called for them)
+//////////////////////////////////////////////////////////////////////
+
+void
+Uring::fail(int error,std::vector<unsigned>& done) {
+
+	dead = error;
+	to_submit = 0;
+	for ( unsigned slot=0; slot < slots.size(); ++slot ) {
+		s_slot& s = slots[slot];
+
+		if ( !s.busy )
+			continue;
+		if ( !s.error )
+			s.error = error;
+		s.pending = 0;
+		s.busy = false;
+		--ninflight;
+		free_slots.push_back(slot);
+		done.push_back(slot);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////
+// Submit what was started, and wait until at least one slot is done.
+// EAGAIN and EBUSY only mean the kernel wants completions reaped
+// first; any other error from io_uring_enter() is fatal for the ring.
+//////////////////////////////////////////////////////////////////////
+
+void
+Uring::wait(std::vector<unsigned>& done) {
+
+	done.clear();
+	if ( dead ) {
+		fail(dead,done);
+		return;
+	}
+	while ( done.empty() && ninflight > 0 ) {
+		if ( submit(1) == -1 && errno != EAGAIN && errno != EBUSY ) {
+			fail(errno,done);
+			return;
+		}
+
+		unsigned head = *cq_head;
+		const unsigned ctail = __atomic_load_n(cq_tail,__ATOMIC_ACQUIRE);
+
+		for ( ; head != ctail; ++head ) {
+			const io_uring_cqe *cqe = (const io_uring_cqe *)cqes + (head & *cq_mask);
+
+			complete(unsigned(cqe->user_data >> 2),cqe->user_data & 3,cqe->res,done);
+		}
+		__atomic_store_n(cq_head,head,__ATOMIC_RELEASE);
+	}
+	if ( to_submit > 0 )
+		submit(0);		// Next reads, while the caller works
+}
+
+#else	// No io_uring
+
+int Uring::open(unsigned,size_t,bool) { return ENOSYS; }
+void Uring::close() {}
+bool Uring::available(int& error) { error = ENOSYS; return false; }
+unsigned Uring::prefix(const std::string&,size_t) { return 0; }
+unsigned Uring::whole(const std::string&) { return 0; }
+void Uring::wait(std::vector<unsigned>& done) { done.clear(); }
+
+#endif
+
+// End uring.cpp
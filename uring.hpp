@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////
+// uring.hpp -- io_uring batch reader for fingerprints and hashes
+// Date: Sun Oct 18 19:26:05 2026   (C) datablocks.net
+///////////////////////////////////////////////////////////////////////
+
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "hash128.hpp"
+
+//////////////////////////////////////////////////////////////////////
+// One ring per worker thread, driven through the raw syscalls (no
+// liburing). Each of depth slots reads one file at a time into its
+// own registered buffer, through a fixed file table: openat installs
+// the file in the slot's table entry, and the reads and close use it
+// from there, so a prefix read is one linked open, read and close.
+// A whole file is read a buffer at a time and hashed as each read
+// completes, while the other slots' reads are in flight.
+//
+// Slots that are started are submitted together by wait(), which
+// returns the slots that have finished (file closed).
+//////////////////////////////////////////////////////////////////////
+
+class Uring {
+	struct s_slot {
+		bool		busy = false;
+		bool		whole = false;	// Hash whole file, else prefix
+		std::string	path;
+		uint64_t	size = 0;	// Prefix bytes to read
+		uint64_t	offset = 0;	// Read so far
+		unsigned	pending = 0;	// CQEs to come
+		bool		opened = false;
+		bool		eof = false;
+		bool		buffered = false; // O_DIRECT refused
+		int		error = 0;
+		Hash128		hash;
+	};
+
+	int		fd = -1;
+	unsigned	sq_entries = 0;
+	unsigned	*sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+	unsigned	*cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+	void		*cqes = nullptr;
+	void		*sqes = nullptr;
+	void		*sq_ring = nullptr, *cq_ring = nullptr;
+	size_t		sq_ring_sz = 0, cq_ring_sz = 0, sqes_sz = 0;
+	unsigned	tail = 0;		// Local SQ tail
+	unsigned	to_submit = 0;
+
+	bool		direct = false;		// Open with O_DIRECT
+	bool		fixed_bufs = false;	// Buffers registered
+	size_t		bufsiz = 0;
+	char		*bufs = nullptr;	// depth * bufsiz
+	std::vector<s_slot> slots;
+	std::vector<unsigned> free_slots;
+	unsigned	ninflight = 0;
+	int		dead = 0;		// errno that broke the ring
+
+	void *get_sqe();
+	void queue_open(unsigned slot,bool link);
+	void queue_read(unsigned slot,bool link);
+	void queue_close(unsigned slot);
+	int submit(unsigned min_complete);
+	void complete(unsigned slot,uint64_t op,int res,std::vector<unsigned>& done);
+	void fail(int error,std::vector<unsigned>& done);
+
+public:	struct s_stats {
+		uint64_t	submits = 0;	// io_uring_enter calls
+		uint64_t	sqes = 0;
+		uint64_t	bytes = 0;
+	} stats;
+
+	Uring() {}
+	Uring(const Uring&) = delete;
+	~Uring() { close(); }
+
+	static bool available(int& error);
+	int open(unsigned depth,size_t bufsiz,bool direct=false);
+	void close();
+
+	bool full() const { return free_slots.empty(); }
+	unsigned inflight() const { return ninflight; }
+	unsigned prefix(const std::string& path,size_t bytes);
+	unsigned whole(const std::string& path);
+	void wait(std::vector<unsigned>& done);
+
+	// Results of a finished slot, until it is started again
+	int error(unsigned slot) const { return slots[slot].error; }
+	bool opened(unsigned slot) const { return slots[slot].opened; }
+	const char *data(unsigned slot) const { return bufs + slot * bufsiz; }
+	uint64_t bytes(unsigned slot) const { return slots[slot].offset; }
+	hash128_t hash(unsigned slot) { return slots[slot].hash.final(); }
+};
+
+#endif // URING_HPP
+
+// End uring.hpp